@@ -1,17 +1,22 @@
 
 /********************************************************************
 * Stochastically generates a poisson pedigree based on properties
-* read from command-line arguments and prints it to STDOUT.
+* read from command-line arguments and prints it to STDOUT. With
+* -b (--binary), the full pedigree is printed as a binary record.
+* -S (--seed) {seed} fixes the random streams, so that the same seed
+* gives the same pedigree; -j (--threads) {n} generates on n threads.
+* -X (--crossover) {rate} is the chance that consecutive blocks come
+* from different parents (0.5, the default, makes blocks independent),
+* and -l (--layout) {indiv|block|segment} picks how genomes are stored
+* while generating (segment stores runs of equal genes).
 ********************************************************************/
 
-#include "../source/poisson_pedigree.h"
+#include "../source/pedigree_binary.h"
 #include "../source/flags.h"
 
 #include <iostream>
 #include <iterator>
 
-#define STOP_CHAR '~'
-
 int main(int narg, char** args)
 {
 
@@ -20,18 +25,45 @@ int main(int narg, char** args)
         std::cin >> std::noskipws;
         std::istream_iterator<char> it(std::cin), end;
         poisson_pedigree* ped = poisson_pedigree::parse_shorthand(std::string(it, end));
-        std::cout << ped->dump_extant() << std::endl << STOP_CHAR << std::endl << ped->dump() << std::endl;
+        dump_writer out(std::cout);
+        ped->dump_extant(out);
+        out << '\n' << STOP_CHAR << '\n';
+        ped->dump(out);
+        out << '\n';
         return 0;
     }
 
     // Read pedigree properties
     std::string arg;
+    bool binary = false;
+    poisson_pedigree* ped = new poisson_pedigree();
     for (int i = 1; i < narg; i++)
-        arg += std::string(args[i]) + " ";
-    poisson_pedigree* ped = poisson_pedigree::recover_dumped(arg, new poisson_pedigree());
+        if (std::string(args[i]) == "-b" || std::string(args[i]) == "--binary")
+            binary = true;
+        else if ((std::string(args[i]) == "-S" || std::string(args[i]) == "--seed") && i + 1 < narg)
+            ped->set_seed(std::stoull(args[++i]));
+        else if ((std::string(args[i]) == "-j" || std::string(args[i]) == "--threads") && i + 1 < narg)
+            ped->set_threads(std::stoi(args[++i]));
+        else if ((std::string(args[i]) == "-X" || std::string(args[i]) == "--crossover") && i + 1 < narg)
+            ped->set_crossover(std::stod(args[++i]));
+        else if ((std::string(args[i]) == "-l" || std::string(args[i]) == "--layout") && i + 1 < narg) {
+            std::string layout = args[++i];
+            ped->set_genome_layout(layout == "segment" ? GENOME_SEGMENTS : layout == "block" ? GENOME_BLOCK_MAJOR : GENOME_INDIV_MAJOR);
+        }
+        else
+            arg += std::string(args[i]) + " ";
+    ped = poisson_pedigree::recover_dumped(arg, ped);
 
     // Generate and print pedigree
-    std::cout << ped->build()->dump_extant() << std::endl << STOP_CHAR << std::endl << ped->dump() << std::endl;
+    if (binary)
+        std::cout << ped->build()->dump_binary();
+    else {
+        dump_writer out(std::cout);
+        ped->build()->dump_extant(out);
+        out << '\n' << STOP_CHAR << '\n';
+        ped->dump(out);
+        out << '\n';
+    }
     return 0;
 
 }
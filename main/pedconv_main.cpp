@@ -0,0 +1,56 @@
+/********************************************************************
+* Converts poisson pedigrees between the text and binary formats.
+* Reads pedigrees from STDIN and writes each full pedigree to STDOUT
+* in the other format: text dumps become binary records (extant-only
+* dumps are skipped), and binary records become text dumps in the
+* form written by mkped.
+********************************************************************/
+
+#include "../source/pedigree_binary.h"
+#include "../source/flags.h"
+
+#include <iostream>
+
+int main(int narg, char** args)
+{
+
+    // Flag definitions
+    bool rec = false;
+    flag_reader fr;
+    /// Write bare full dumps (as recgen does) instead of extant ~ full
+    fr.add_flag("rec", 'r', 0, [&](std::vector<std::string> v, void* p) { rec = true; });
+    if (fr.read_flags(narg, args) != FLAGS_INPUT_SUCCESS) {
+        std::cout << "Invalid commands" << std::endl;
+        return 1;
+    }
+
+    // Convert every pedigree on STDIN
+    /// Text dumps are separated, as mkped separates them, by STOP_CHAR
+    /// lines between dumps only
+    pedigree_input in(0);
+    bool first_text = true;
+    while (!in.done()) {
+        bool binary = in.next_binary();
+        poisson_pedigree* ped = in.next(false);
+        if (!binary) {
+            /// Extant-only dumps leave every grade above the first empty
+            if (!(*ped)[ped->num_grade() - 1].empty())
+                std::cout << ped->dump_binary();
+        }
+        else {
+            dump_writer out(std::cout);
+            if (!first_text)
+                out << STOP_CHAR << '\n';
+            first_text = false;
+            if (!rec) {
+                ped->dump_extant(out);
+                out << '\n' << STOP_CHAR << '\n';
+            }
+            ped->dump(out);
+            out << '\n';
+        }
+        delete ped->purge();
+    }
+    return 0;
+
+}
@@ -1,10 +1,11 @@
 
 /********************************************************************
 * Reads the extant population of a poisson pedigree from STDIN and
-* writes a poisson pedigree rebuilt with REC-GEN to STDOUT.
+* writes a poisson pedigree rebuilt with REC-GEN to STDOUT. The
+* input may be a text dump or a binary record.
 ********************************************************************/
 
-#include "../source/poisson_pedigree.h"
+#include "../source/pedigree_binary.h"
 
 #include "../source/rec_gen_recursive.h"
 #include "../source/rec_gen_parsimony.h"
@@ -13,24 +14,24 @@
 
 #include <iostream>
 
-#define STOP_CHAR '~'
-
 int main(int narg, char** args)
 {
 
     // Construct pedigree from STDIN
-    std::string extant_dump, line;
-    std::getline(std::cin, extant_dump, STOP_CHAR);
-    poisson_pedigree* ped = poisson_pedigree::recover_dumped(extant_dump, new poisson_pedigree());
+    pedigree_input in(0);
+    poisson_pedigree* ped = in.next(true);
+    bool binary = false;
 
     // Prepare the Rec-Gen object
     rec_gen* recrec = new rec_gen_recursive(ped);
-    rec_gen* recgen = new rec_gen_quadratic(ped);
+    rec_gen* recquad = new rec_gen_quadratic(ped);
     rec_gen* recpar = new rec_gen_parsimony(ped);
     rec_gen* recbas = new rec_gen_basic(ped);
     rec_gen* recbp  = new rec_gen_bp(ped);
+    /// The engine to run, picked by the flags
+    rec_gen* recgen = recquad;
 
-    recpar->settings = recbp->settings = recrec->settings = recgen->settings = recbas->settings = LOG_WORK | LOG_DATA;
+    recpar->settings = recbp->settings = recrec->settings = recquad->settings = recbas->settings = LOG_WORK | LOG_DATA;
 
     // Flag definitions
     flag_reader fr;
@@ -54,10 +55,39 @@ int main(int narg, char** args)
     fr.add_flag("recursive", 'R', 0, [&](std::vector<std::string> v, void* p) { recgen = recrec; });
     fr.add_flag("bp", 'B', 0, [&](std::vector<std::string> v, void* p) { recgen = recbp; });
     fr.add_flag("epsilon", 'e', 1, [&](std::vector<std::string> v, void* p) { static_cast<rec_gen_bp*>(recgen)->set_epsilon(std::stod(v[0])); });
-    fr.add_flag("memmode", 'm', 1, [&](std::vector<std::string> v, void* p) { static_cast<rec_gen_bp*>(recgen)->set_memory_mode(std::stoi(v[0])); });
+    fr.add_flag("bp-mem-budget", 'M', 1, [&](std::vector<std::string> v, void* p) { static_cast<rec_gen_bp*>(recbp)->set_mem_budget(parse_bytes(v[0])); });
+    fr.add_flag("numeric", 'n', 1, [&](std::vector<std::string> v, void* p) {
+        int numeric = BP_DOUBLE;
+        for (auto s : split_opts(v[0]))
+            if (s == "log")
+                numeric |= BP_LOG_SPACE;
+            else
+                numeric = (numeric & BP_LOG_SPACE) | (s == "float" ? BP_FLOAT : s == "long" ? BP_LONG_DOUBLE : BP_DOUBLE);
+        static_cast<rec_gen_bp*>(recbp)->set_numeric(numeric);
+    });
     fr.add_flag("parsimony", 'P', 0, [&](std::vector<std::string> v, void* p) { recgen = recpar; });
     fr.add_flag("notop", 't', 0, [&](std::vector<std::string> v, void* p) { recgen->set_no_top(1); });
     fr.add_flag("prune", 'p', 0, [&](std::vector<std::string> v, void* p) { static_cast<rec_gen_quadratic*>(recgen)->prune(); });
+    fr.add_flag("threads", 'j', 1, [&](std::vector<std::string> v, void* p) {
+        for (rec_gen* r : { recrec, recquad, recpar, recbas, recbp })
+            r->set_threads(std::stoi(v[0]));
+    });
+    fr.add_flag("cliques", 'k', 1, [&](std::vector<std::string> v, void* p) {
+        for (rec_gen* r : { recrec, recquad, recpar, recbas, recbp })
+            static_cast<rec_gen_basic*>(r)->set_clique_mode(v[0] == "recursive" ? CLIQUE_RECURSIVE : v[0] == "packed" ? CLIQUE_PACKED : CLIQUE_INCREMENTAL);
+    });
+    fr.add_flag("sequential", 'q', 1, [&](std::vector<std::string> v, void* p) {
+        for (rec_gen* r : { recrec, recquad, recpar, recbas, recbp })
+            static_cast<rec_gen_basic*>(r)->set_sequential(std::stod(v[0]));
+    });
+    fr.add_flag("lsh", 'H', 1, [&](std::vector<std::string> v, void* p) {
+        std::vector<std::string> parg = split_opts(v[0]);
+        /// Only the engines built on rec_gen_quadratic search candidate pairs
+        for (rec_gen* r : { recrec, recquad, recpar, recbp })
+            static_cast<rec_gen_quadratic*>(r)->set_lsh(std::stoi(parg[0]), parg.size() > 1 ? std::stoi(parg[1]) : 1);
+    });
+    fr.add_flag("binary", 'b', 0, [&](std::vector<std::string> v, void* p) { binary = true; });
+    fr.add_flag("layout", 'l', 1, [&](std::vector<std::string> v, void* p) { ped->set_genome_layout(v[0] == "segment" ? GENOME_SEGMENTS : v[0] == "block" ? GENOME_BLOCK_MAJOR : GENOME_INDIV_MAJOR); });
 
     if (fr.read_flags(narg, args) != FLAGS_INPUT_SUCCESS) {
         std::cout << "Invalid commands" << std::endl;
@@ -66,7 +96,13 @@ int main(int narg, char** args)
 
     // Run REC-GEN
     recgen->init()->apply_rec_gen();
-    std::cout << recgen->get_pedigree()->dump() << std::endl;
+    if (binary)
+        std::cout << recgen->get_pedigree()->dump_binary();
+    else {
+        dump_writer out(std::cout);
+        recgen->get_pedigree()->dump(out);
+        out << '\n';
+    }
     delete ped;
     return 0;
 
@@ -2,26 +2,23 @@
 /********************************************************************
 * Reads two poisson pedigrees (an original and a reconstructed
 * version) from STDIN and writes statistics about the accuracy of the
-* reconstruction to STDOUT
+* reconstruction to STDOUT; either may be a text dump or a binary
+* record
 ********************************************************************/
 
-#include "../source/poisson_pedigree.h"
+#include "../source/pedigree_binary.h"
 #include "../source/tree_diff_basic.h"
 #include "../source/flags.h"
 
 #include <iostream>
 
-#define STOP_CHAR '~'
-
 int main(int narg, char** args)
 {
 
     // Construct pedigrees from STDIN
-    std::string extant_dump, line;
-    std::getline(std::cin, extant_dump, STOP_CHAR);
-    poisson_pedigree* ped = poisson_pedigree::recover_dumped(extant_dump, new poisson_pedigree());
-    std::getline(std::cin, extant_dump, STOP_CHAR);
-    poisson_pedigree* rec = poisson_pedigree::recover_dumped(extant_dump, new poisson_pedigree());
+    pedigree_input in(0);
+    poisson_pedigree* ped = in.next(false);
+    poisson_pedigree* rec = in.next(false);
 
     // Prepare the tree diff object
     tree_diff_basic* diff = new tree_diff_basic(ped, rec);
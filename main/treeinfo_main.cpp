@@ -5,19 +5,17 @@
 ********************************************************************/
 
 #include "../source/tree_analyze.h"
+#include "../source/pedigree_binary.h"
 
 #include <iostream>
 #include <sstream>
 
-#define STOP_CHAR '~'
-
 int main(int narg, char** args)
 {
 
     // Construct pedigree from STDIN
-    std::string extant_dump, line;
-    std::getline(std::cin, extant_dump, STOP_CHAR);
-    poisson_pedigree* ped = poisson_pedigree::recover_dumped(extant_dump, new poisson_pedigree());
+    pedigree_input in(0);
+    poisson_pedigree* ped = in.next(false);
 
     // Get analysis data through flags
     preprocess* prep = new preprocess(ped);
@@ -51,9 +49,23 @@ int main(int narg, char** args)
         }
         std::cout << std::endl;
     });
+    fr.add_flag("lsh", 'H', 1, [&](std::vector<std::string> v, void* p) {
+        auto opts = split_opts(v[0]);
+        int bands = std::stoi(opts[0]);
+        int rows = opts.size() > 1 && opts[1] != "" ? std::stoi(opts[1]) : 1;
+        /// The candidate threshold defaults to that of recgen
+        double cand = opts.size() > 2 && opts[2] != "" ? std::stod(opts[2]) : 0.21;
+        auto recall = lsh_recall(prep, bands, rows, cand);
+        for (int g = 0; g < recall.size(); g++)
+            std::cout << "Generation " << g << ":\t" << recall[g].found << "/" << recall[g].exact << "\t"
+                << (100 * recall[g].found / std::max(1LL, recall[g].exact)) << "%\tchecked "
+                << recall[g].checked << "/" << recall[g].total << "\n";
+        std::cout << std::endl;
+    });
     fr.add_flag("dump", 'd', 1, [&](std::vector<std::string> v, void* p) {
         long long id = std::stoll(v[0]);
-        std:: cout << print_sub_ped(prep, id > 0 ? coupled_node::get_member_by_id(id) : NULL);
+        dump_writer out(std::cout);
+        print_sub_ped(prep, out, id > 0 ? coupled_node::get_member_by_id(id, prep->ped->nodes()) : NULL);
     });
     fr.add_flag("tree", 'T', 3, [&](std::vector<std::string> v, void* p) {
         int B, T, A;
@@ -61,7 +73,11 @@ int main(int narg, char** args)
         T = std::stoi(v[1]);
         A = std::stoi(v[2]);
         poisson_pedigree* ped = tree_ped(B, T, A);
-        std::cout << ped->dump_extant() << std::endl << STOP_CHAR << std::endl << ped->dump() << std::endl;
+        dump_writer out(std::cout);
+        ped->dump_extant(out);
+        out << '\n' << STOP_CHAR << '\n';
+        ped->dump(out);
+        out << '\n';
     });
     if (fr.read_flags(narg, args) != FLAGS_INPUT_SUCCESS) {
         std::cout << "Invalid commands" << std::endl;
@@ -0,0 +1,336 @@
+/********************************************************************
+* Implements the vectorized kernels that count the blocks shared by
+* the genomes of pairs and triples of couples. The best kernel
+* supported by the CPU (AVX-512, AVX2 or scalar) is selected at
+* runtime.
+********************************************************************/
+
+#include "block_kernels.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BLOCK_KERNELS_X86
+#endif
+
+// Signature of a stride-1 kernel over blocks [0, num_blocks)
+typedef int (*block_kernel)(const void* const* rows, int num_blocks);
+
+// A family of kernels for one instruction set, indexed by log2 of the
+// gene width
+struct kernel_table
+{
+    const char* isa;
+    block_kernel pair[4];
+    block_kernel triple[4];
+};
+
+// Index of a gene width (1, 2, 4, 8) in a kernel table
+static int width_index(int width)
+{ return width == 1 ? 0 : width == 2 ? 1 : width == 4 ? 2 : 3; }
+
+// Load the rows of a kernel as typed pointers
+#define TYPED_ROWS(T, n) const T* r[n]; for (int k = 0; k < n; k++) r[k] = static_cast<const T*>(rows[k]);
+
+/************************* SCALAR KERNELS **************************/
+
+// Count shared blocks of a pair over blocks [from, to)
+template <typename T>
+static int scalar_pair(const void* const* rows, size_t stride, int from, int to)
+{
+    TYPED_ROWS(T, 4)
+    int shr = 0;
+    for (size_t i = from * stride, n = to * stride; i < n; i += stride)
+        shr += (r[0][i] && (r[0][i] == r[2][i] || r[0][i] == r[3][i])) ||
+            (r[1][i] && (r[1][i] == r[2][i] || r[1][i] == r[3][i]));
+    return shr;
+}
+
+// Count shared blocks of a triple over blocks [from, to)
+template <typename T>
+static int scalar_triple(const void* const* rows, size_t stride, int from, int to)
+{
+    TYPED_ROWS(T, 6)
+    int shr = 0;
+    for (size_t i = from * stride, n = to * stride; i < n; i += stride)
+        shr += (r[0][i] && (r[2][i] == r[0][i] || r[3][i] == r[0][i]) && (r[4][i] == r[0][i] || r[5][i] == r[0][i])) ||
+            (r[1][i] && (r[2][i] == r[1][i] || r[3][i] == r[1][i]) && (r[4][i] == r[1][i] || r[5][i] == r[1][i]));
+    return shr;
+}
+
+// Table entries for contiguous rows
+template <typename T>
+static int scalar_pair_rows(const void* const* rows, int num_blocks)
+{ return scalar_pair<T>(rows, 1, 0, num_blocks); }
+template <typename T>
+static int scalar_triple_rows(const void* const* rows, int num_blocks)
+{ return scalar_triple<T>(rows, 1, 0, num_blocks); }
+
+static const kernel_table SCALAR_KERNELS = { "scalar",
+    { scalar_pair_rows<uint8_t>, scalar_pair_rows<uint16_t>, scalar_pair_rows<uint32_t>, scalar_pair_rows<uint64_t> },
+    { scalar_triple_rows<uint8_t>, scalar_triple_rows<uint16_t>, scalar_triple_rows<uint32_t>, scalar_triple_rows<uint64_t> } };
+
+#ifdef BLOCK_KERNELS_X86
+
+/************************** AVX2 KERNELS ***************************/
+
+#define AVX2_TARGET __attribute__((target("avx2,popcnt")))
+
+// Lane-wise equality at the gene width
+template <typename T>
+AVX2_TARGET static inline __m256i avx2_eq(__m256i a, __m256i b)
+{
+    if constexpr (sizeof(T) == 1) return _mm256_cmpeq_epi8(a, b);
+    else if constexpr (sizeof(T) == 2) return _mm256_cmpeq_epi16(a, b);
+    else if constexpr (sizeof(T) == 4) return _mm256_cmpeq_epi32(a, b);
+    else return _mm256_cmpeq_epi64(a, b);
+}
+
+// Number of set lanes in a comparison mask
+template <typename T>
+AVX2_TARGET static inline int avx2_count(__m256i m)
+{
+    if constexpr (sizeof(T) == 1) return __builtin_popcount(_mm256_movemask_epi8(m));
+    else if constexpr (sizeof(T) == 2) return __builtin_popcount(_mm256_movemask_epi8(m)) / 2;
+    else if constexpr (sizeof(T) == 4) return __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(m)));
+    else return __builtin_popcount(_mm256_movemask_pd(_mm256_castsi256_pd(m)));
+}
+
+#define AVX2_LOAD(k) _mm256_loadu_si256(reinterpret_cast<const __m256i*>(r[k] + i))
+
+// The vector kernels clear the upper register halves before handing the
+// tail to the scalar kernel and returning: SSE code running with dirty
+// upper halves stalls for hundreds of cycles, which dominates short rows
+
+template <typename T>
+AVX2_TARGET static int avx2_pair(const void* const* rows, int num_blocks)
+{
+    TYPED_ROWS(T, 4)
+    const int lanes = sizeof(__m256i) / sizeof(T);
+    const __m256i zero = _mm256_setzero_si256();
+    int shr = 0, i = 0;
+    for (; i + lanes <= num_blocks; i += lanes) {
+        __m256i u0 = AVX2_LOAD(0), u1 = AVX2_LOAD(1), v0 = AVX2_LOAD(2), v1 = AVX2_LOAD(3);
+        /// A lane matches if a non-zero gene of u equals either gene of v
+        __m256i m0 = _mm256_andnot_si256(avx2_eq<T>(u0, zero), _mm256_or_si256(avx2_eq<T>(u0, v0), avx2_eq<T>(u0, v1)));
+        __m256i m1 = _mm256_andnot_si256(avx2_eq<T>(u1, zero), _mm256_or_si256(avx2_eq<T>(u1, v0), avx2_eq<T>(u1, v1)));
+        shr += avx2_count<T>(_mm256_or_si256(m0, m1));
+    }
+    _mm256_zeroupper();
+    return shr + scalar_pair<T>(rows, 1, i, num_blocks);
+}
+
+template <typename T>
+AVX2_TARGET static int avx2_triple(const void* const* rows, int num_blocks)
+{
+    TYPED_ROWS(T, 6)
+    const int lanes = sizeof(__m256i) / sizeof(T);
+    const __m256i zero = _mm256_setzero_si256();
+    int shr = 0, i = 0;
+    for (; i + lanes <= num_blocks; i += lanes) {
+        __m256i u0 = AVX2_LOAD(0), u1 = AVX2_LOAD(1), v0 = AVX2_LOAD(2), v1 = AVX2_LOAD(3), w0 = AVX2_LOAD(4), w1 = AVX2_LOAD(5);
+        /// A lane matches if a non-zero gene of u is carried by both v and w
+        __m256i m0 = _mm256_andnot_si256(avx2_eq<T>(u0, zero), _mm256_and_si256(
+            _mm256_or_si256(avx2_eq<T>(v0, u0), avx2_eq<T>(v1, u0)), _mm256_or_si256(avx2_eq<T>(w0, u0), avx2_eq<T>(w1, u0))));
+        __m256i m1 = _mm256_andnot_si256(avx2_eq<T>(u1, zero), _mm256_and_si256(
+            _mm256_or_si256(avx2_eq<T>(v0, u1), avx2_eq<T>(v1, u1)), _mm256_or_si256(avx2_eq<T>(w0, u1), avx2_eq<T>(w1, u1))));
+        shr += avx2_count<T>(_mm256_or_si256(m0, m1));
+    }
+    _mm256_zeroupper();
+    return shr + scalar_triple<T>(rows, 1, i, num_blocks);
+}
+
+static const kernel_table AVX2_KERNELS = { "avx2",
+    { avx2_pair<uint8_t>, avx2_pair<uint16_t>, avx2_pair<uint32_t>, avx2_pair<uint64_t> },
+    { avx2_triple<uint8_t>, avx2_triple<uint16_t>, avx2_triple<uint32_t>, avx2_triple<uint64_t> } };
+
+/************************* AVX-512 KERNELS *************************/
+
+#define AVX512_TARGET __attribute__((target("avx512f,avx512bw,popcnt")))
+
+// Lane-wise equality and non-zero masks at the gene width
+template <typename T>
+AVX512_TARGET static inline uint64_t avx512_eq(__m512i a, __m512i b)
+{
+    if constexpr (sizeof(T) == 1) return _mm512_cmpeq_epi8_mask(a, b);
+    else if constexpr (sizeof(T) == 2) return _mm512_cmpeq_epi16_mask(a, b);
+    else if constexpr (sizeof(T) == 4) return _mm512_cmpeq_epi32_mask(a, b);
+    else return _mm512_cmpeq_epi64_mask(a, b);
+}
+template <typename T>
+AVX512_TARGET static inline uint64_t avx512_nz(__m512i a)
+{
+    if constexpr (sizeof(T) == 1) return _mm512_test_epi8_mask(a, a);
+    else if constexpr (sizeof(T) == 2) return _mm512_test_epi16_mask(a, a);
+    else if constexpr (sizeof(T) == 4) return _mm512_test_epi32_mask(a, a);
+    else return _mm512_test_epi64_mask(a, a);
+}
+
+#define AVX512_LOAD(k) _mm512_loadu_si512(r[k] + i)
+
+template <typename T>
+AVX512_TARGET static int avx512_pair(const void* const* rows, int num_blocks)
+{
+    TYPED_ROWS(T, 4)
+    const int lanes = sizeof(__m512i) / sizeof(T);
+    int shr = 0, i = 0;
+    for (; i + lanes <= num_blocks; i += lanes) {
+        __m512i u0 = AVX512_LOAD(0), u1 = AVX512_LOAD(1), v0 = AVX512_LOAD(2), v1 = AVX512_LOAD(3);
+        uint64_t m0 = avx512_nz<T>(u0) & (avx512_eq<T>(u0, v0) | avx512_eq<T>(u0, v1));
+        uint64_t m1 = avx512_nz<T>(u1) & (avx512_eq<T>(u1, v0) | avx512_eq<T>(u1, v1));
+        shr += __builtin_popcountll(m0 | m1);
+    }
+    _mm256_zeroupper();
+    return shr + scalar_pair<T>(rows, 1, i, num_blocks);
+}
+
+template <typename T>
+AVX512_TARGET static int avx512_triple(const void* const* rows, int num_blocks)
+{
+    TYPED_ROWS(T, 6)
+    const int lanes = sizeof(__m512i) / sizeof(T);
+    int shr = 0, i = 0;
+    for (; i + lanes <= num_blocks; i += lanes) {
+        __m512i u0 = AVX512_LOAD(0), u1 = AVX512_LOAD(1), v0 = AVX512_LOAD(2), v1 = AVX512_LOAD(3), w0 = AVX512_LOAD(4), w1 = AVX512_LOAD(5);
+        uint64_t m0 = avx512_nz<T>(u0) & (avx512_eq<T>(v0, u0) | avx512_eq<T>(v1, u0)) & (avx512_eq<T>(w0, u0) | avx512_eq<T>(w1, u0));
+        uint64_t m1 = avx512_nz<T>(u1) & (avx512_eq<T>(v0, u1) | avx512_eq<T>(v1, u1)) & (avx512_eq<T>(w0, u1) | avx512_eq<T>(w1, u1));
+        shr += __builtin_popcountll(m0 | m1);
+    }
+    _mm256_zeroupper();
+    return shr + scalar_triple<T>(rows, 1, i, num_blocks);
+}
+
+static const kernel_table AVX512_KERNELS = { "avx512",
+    { avx512_pair<uint8_t>, avx512_pair<uint16_t>, avx512_pair<uint32_t>, avx512_pair<uint64_t> },
+    { avx512_triple<uint8_t>, avx512_triple<uint16_t>, avx512_triple<uint32_t>, avx512_triple<uint64_t> } };
+
+#endif
+
+/************************** RUN KERNELS ****************************/
+
+// Walk the runs of n segmented genomes together, calling count with the
+// genes of each stretch of blocks where no genome changes and adding
+// its result times the length of the stretch
+/// With a threshold, the walk stops once the outcome is settled
+template <int n, typename F>
+static int walk_runs(const genome_segment* const* rows, const genome_segment* const* ends, int num_blocks, int need, int stop, F count)
+{
+    const genome_segment* r[n];
+    gene g[n];
+    for (int k = 0; k < n; k++)
+        r[k] = rows[k];
+    int shr = 0;
+    for (int b = 0, end; b < num_blocks; b = end) {
+        if (kernel_settled(shr, num_blocks - b, need, stop))
+            break;
+        end = num_blocks;
+        for (int k = 0; k < n; k++) {
+            g[k] = r[k]->g;
+            if (r[k] + 1 < ends[k] && r[k][1].start < end)
+                end = r[k][1].start;
+        }
+        shr += count(g) * (end - b);
+        for (int k = 0; k < n; k++)
+            if (r[k] + 1 < ends[k] && r[k][1].start == end)
+                r[k]++;
+    }
+    return shr;
+}
+
+// Count the blocks in which two segmented couples have a non-zero gene in common
+int count_shared_pair_runs(const genome_segment* const* rows, const genome_segment* const* ends, int num_blocks, int need, int stop)
+{
+    return walk_runs<4>(rows, ends, num_blocks, need, stop, [](const gene* g) {
+        return (g[0] && (g[0] == g[2] || g[0] == g[3])) || (g[1] && (g[1] == g[2] || g[1] == g[3]));
+    });
+}
+
+// Count the blocks in which a gene of the first segmented couple is
+// carried by both other couples
+int count_shared_triple_runs(const genome_segment* const* rows, const genome_segment* const* ends, int num_blocks, int need, int stop)
+{
+    return walk_runs<6>(rows, ends, num_blocks, need, stop, [](const gene* g) {
+        return (g[0] && (g[2] == g[0] || g[3] == g[0]) && (g[4] == g[0] || g[5] == g[0])) ||
+            (g[1] && (g[2] == g[1] || g[3] == g[1]) && (g[4] == g[1] || g[5] == g[1]));
+    });
+}
+
+/**************************** DISPATCH *****************************/
+
+// Pick the widest kernels the CPU supports (once, on first use)
+static const kernel_table* detect_kernels()
+{
+#ifdef BLOCK_KERNELS_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw"))
+        return &AVX512_KERNELS;
+    if (__builtin_cpu_supports("avx2"))
+        return &AVX2_KERNELS;
+#endif
+    return &SCALAR_KERNELS;
+}
+static const kernel_table* active_kernels()
+{
+    static const kernel_table* active = detect_kernels();
+    return active;
+}
+
+// Count blocks [0, num_blocks) with count(from, to), a chunk at a time
+// if there is a threshold, until the outcome is settled
+template <typename F>
+static int count_chunks(int num_blocks, int need, int stop, F count)
+{
+    if (need < 0)
+        return count(0, num_blocks);
+    int shr = 0;
+    for (int b = 0; b < num_blocks && !kernel_settled(shr, num_blocks - b, need, stop); b += KERNEL_CHUNK)
+        shr += count(b, std::min(num_blocks, b + KERNEL_CHUNK));
+    return shr;
+}
+
+// Count shared blocks [from, to) of n stride-1 rows with a kernel
+template <int n>
+static int chunk_rows(block_kernel kernel, const void* const* rows, int width, int from, int to)
+{
+    const void* r[n];
+    for (int k = 0; k < n; k++)
+        r[k] = static_cast<const char*>(rows[k]) + (size_t)from * width;
+    return kernel(r, to - from);
+}
+
+// Count the blocks in which two couples have a non-zero gene in common
+int count_shared_pair(const void* const* rows, int width, size_t stride, int num_blocks, int need, int stop)
+{
+    return count_chunks(num_blocks, need, stop, [&](int from, int to) {
+        if (stride == 1)
+            return chunk_rows<4>(active_kernels()->pair[width_index(width)], rows, width, from, to);
+        switch (width) {
+            case 1: return scalar_pair<uint8_t>(rows, stride, from, to);
+            case 2: return scalar_pair<uint16_t>(rows, stride, from, to);
+            case 4: return scalar_pair<uint32_t>(rows, stride, from, to);
+            default: return scalar_pair<uint64_t>(rows, stride, from, to);
+        }
+    });
+}
+
+// Count the blocks in which a gene of the first couple is carried by
+// both other couples
+int count_shared_triple(const void* const* rows, int width, size_t stride, int num_blocks, int need, int stop)
+{
+    return count_chunks(num_blocks, need, stop, [&](int from, int to) {
+        if (stride == 1)
+            return chunk_rows<6>(active_kernels()->triple[width_index(width)], rows, width, from, to);
+        switch (width) {
+            case 1: return scalar_triple<uint8_t>(rows, stride, from, to);
+            case 2: return scalar_triple<uint16_t>(rows, stride, from, to);
+            case 4: return scalar_triple<uint32_t>(rows, stride, from, to);
+            default: return scalar_triple<uint64_t>(rows, stride, from, to);
+        }
+    });
+}
+
+// Name of the instruction set of the kernels selected at runtime
+const char* block_kernel_isa() { return active_kernels()->isa; }
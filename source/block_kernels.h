@@ -0,0 +1,57 @@
+/********************************************************************
+* Defines the vectorized kernels that count the blocks shared by the
+* genomes of pairs and triples of couples. The best kernel supported
+* by the CPU (AVX-512, AVX2 or scalar) is selected at runtime.
+********************************************************************/
+
+#ifndef BLOCK_KERNELS_H
+#define BLOCK_KERNELS_H
+
+#include "genome_store.h"
+
+#include <cstddef>
+
+// Kernels operate on raw genome rows as handed out by genome_store::row:
+// all rows have the same gene width (1, 2, 4 or 8 bytes) and consecutive
+// blocks of a row are `stride` genes apart. Only stride-1 rows are
+// vectorized; strided rows use the scalar kernel.
+
+// Given a threshold need >= 0, kernels only decide whether the count
+// reaches it: blocks are counted KERNEL_CHUNK at a time, stopping once
+// the count can no longer reach need and, with KERNEL_STOP_SETTLED, once
+// it reaches need. The result is at least need if and only if the full
+// count is; with KERNEL_STOP_FAILED, counts that reach need are exact.
+// A negative need (the default) counts every block.
+#define KERNEL_CHUNK 256
+#define KERNEL_COUNT_ALL -1
+#define KERNEL_STOP_SETTLED 0
+#define KERNEL_STOP_FAILED 1
+
+// Whether a count of shr, with left blocks still to count, is settled
+// against need under a stopping rule
+inline bool kernel_settled(int shr, int left, int need, int stop)
+{ return need >= 0 && (shr + left < need || (stop == KERNEL_STOP_SETTLED && shr >= need)); }
+
+// Count the blocks in which couple (rows[0], rows[1]) and couple
+// (rows[2], rows[3]) have a non-zero gene in common
+int count_shared_pair(const void* const* rows, int width, size_t stride, int num_blocks, int need = KERNEL_COUNT_ALL,
+    int stop = KERNEL_STOP_SETTLED);
+
+// Count the blocks in which one of the non-zero genes of couple
+// (rows[0], rows[1]) is also carried by both couple (rows[2], rows[3])
+// and couple (rows[4], rows[5])
+int count_shared_triple(const void* const* rows, int width, size_t stride, int num_blocks, int need = KERNEL_COUNT_ALL,
+    int stop = KERNEL_STOP_SETTLED);
+
+// The same counts over segmented genomes: rows[k] to ends[k] are the
+// runs of the kth genome, which are walked together, a stretch of
+// blocks where no genome changes at a time
+int count_shared_pair_runs(const genome_segment* const* rows, const genome_segment* const* ends, int num_blocks,
+    int need = KERNEL_COUNT_ALL, int stop = KERNEL_STOP_SETTLED);
+int count_shared_triple_runs(const genome_segment* const* rows, const genome_segment* const* ends, int num_blocks,
+    int need = KERNEL_COUNT_ALL, int stop = KERNEL_STOP_SETTLED);
+
+// Name of the instruction set of the kernels selected at runtime
+const char* block_kernel_isa();
+
+#endif
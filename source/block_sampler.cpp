@@ -0,0 +1,149 @@
+/********************************************************************
+* Implements sequential tests of the shared-block thresholds
+********************************************************************/
+
+#include "block_sampler.h"
+#include "philox.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+// Constructor
+/// The order is a fixed shuffle, so that results do not vary between runs
+/// The margin at a look of k blocks out of B is sqrt((1 - (k - 1) / B) *
+/// ln(L / error) / 2k) for L looks (Serfling's bound for sampling without
+/// replacement, split evenly over the looks)
+block_sampler::block_sampler(int num_blocks, double error) : order(num_blocks), num_blocks(num_blocks),
+    num_test(0), num_read(0), num_exact(0)
+{
+    for (int b = 0; b < num_blocks; b++)
+        this->order[b] = b;
+    philox rng(SAMPLER_SEED, 0);
+    std::shuffle(this->order.begin(), this->order.end(), rng);
+    for (int k = SAMPLER_FIRST; k < SAMPLER_EXACT * num_blocks; k *= 2)
+        this->looks.push_back(k);
+    /// The blocks read between two looks are read in increasing order,
+    /// which does not change the sample at any look
+    for (size_t l = 0; l < this->looks.size(); l++)
+        std::sort(this->order.begin() + (l ? this->looks[l - 1] : 0), this->order.begin() + this->looks[l]);
+    for (int k : this->looks)
+        this->margin.push_back(std::sqrt((1 - (k - 1.0) / num_blocks) * std::log(this->looks.size() / error) / (2 * k)));
+}
+
+// Decide the test given whether each block is shared
+/// A settled outcome is reported as the scaled sample count, moved to the
+/// right side of need if rounding put it on the wrong one
+template <typename F, typename E>
+int block_sampler::decide(F hit, E exact, double need) const
+{
+    this->num_test++;
+    int k = 0, shr = 0;
+    double share = need / this->num_blocks;
+    for (size_t l = 0; l < this->looks.size(); l++) {
+        for (; k < this->looks[l]; k++)
+            shr += hit(this->order[k]);
+        double seen = (double)shr / k;
+        int est = std::lround(seen * this->num_blocks);
+        if (seen - this->margin[l] >= share) {
+            this->num_read += k;
+            return std::max(est, (int)std::ceil(need));
+        }
+        if (seen + this->margin[l] < share) {
+            this->num_read += k;
+            return std::min(est, (int)std::ceil(need) - 1);
+        }
+    }
+    this->num_read += k + this->num_blocks;
+    this->num_exact++;
+    return exact();
+}
+
+// Gather the genome rows of the members of some couples, in order
+/// Returns the store holding them, or NULL if they are not all rows of
+/// one store (e.g. a segmented one)
+static genome_store* sample_rows(std::initializer_list<coupled_node*> couples, const void** rows)
+{
+    genome_store* store = (**couples.begin())[0]->get_genome();
+    for (coupled_node* c : couples)
+        for (int i = 0; i < 2; i++) {
+            if ((*c)[i]->get_genome() != store || store->get_layout() == GENOME_SEGMENTS)
+                return NULL;
+            *rows++ = store->row((*c)[i]->get_slot());
+        }
+    return store;
+}
+
+// Whether block b is shared by a pair, or a triple, of couples whose
+// genomes are rows of genes of type T
+/// A block is shared if a non-zero gene of the first couple is carried
+/// by the others
+template <typename T>
+static bool pair_hit(const void* const* rows, size_t stride, int b)
+{
+    T g[4];
+    for (int k = 0; k < 4; k++)
+        g[k] = reinterpret_cast<const T*>(rows[k])[b * stride];
+    return (g[0] && (g[0] == g[2] || g[0] == g[3])) || (g[1] && (g[1] == g[2] || g[1] == g[3]));
+}
+template <typename T>
+static bool triple_hit(const void* const* rows, size_t stride, int b)
+{
+    T g[6];
+    for (int k = 0; k < 6; k++)
+        g[k] = reinterpret_cast<const T*>(rows[k])[b * stride];
+    return (g[0] && (g[0] == g[2] || g[0] == g[3]) && (g[0] == g[4] || g[0] == g[5])) ||
+        (g[1] && (g[1] == g[2] || g[1] == g[3]) && (g[1] == g[4] || g[1] == g[5]));
+}
+
+// Pick the reader of a gene width
+#define SAMPLER_DISPATCH(width, hit, call) \
+    switch (width) { \
+        case 1: { auto hit = hit##_hit<uint8_t>; return call; } \
+        case 2: { auto hit = hit##_hit<uint16_t>; return call; } \
+        case 4: { auto hit = hit##_hit<uint32_t>; return call; } \
+        default: { auto hit = hit##_hit<uint64_t>; return call; } \
+    }
+
+// Shared blocks of a pair, if settled by a sample
+int block_sampler::shared_blocks(coupled_node* u, coupled_node* v, double need) const
+{
+    auto exact = [&]() { return ::shared_blocks(u, v, (int)std::ceil(need)); };
+    const void* rows[4];
+    if (genome_store* store = sample_rows({ u, v }, rows)) {
+        size_t stride = store->block_stride();
+        SAMPLER_DISPATCH(store->bytes_per_gene(), pair,
+            this->decide([&](int b) { return pair(rows, stride, b); }, exact, need))
+    }
+    return this->decide([&](int b) {
+        gene g0 = (*(*u)[0])[b], g1 = (*(*u)[1])[b], h0 = (*(*v)[0])[b], h1 = (*(*v)[1])[b];
+        return (g0 && (g0 == h0 || g0 == h1)) || (g1 && (g1 == h0 || g1 == h1));
+    }, exact, need);
+}
+
+// Shared blocks of a triple, if settled by a sample
+int block_sampler::shared_blocks(coupled_node* u, coupled_node* v, coupled_node* w, double need) const
+{
+    auto exact = [&]() { return ::shared_blocks(u, v, w, (int)std::ceil(need)); };
+    const void* rows[6];
+    if (genome_store* store = sample_rows({ u, v, w }, rows)) {
+        size_t stride = store->block_stride();
+        SAMPLER_DISPATCH(store->bytes_per_gene(), triple,
+            this->decide([&](int b) { return triple(rows, stride, b); }, exact, need))
+    }
+    return this->decide([&](int b) {
+        gene g0 = (*(*u)[0])[b], g1 = (*(*u)[1])[b], h0 = (*(*v)[0])[b], h1 = (*(*v)[1])[b];
+        gene i0 = (*(*w)[0])[b], i1 = (*(*w)[1])[b];
+        return (g0 && (g0 == h0 || g0 == h1) && (g0 == i0 || g0 == i1)) ||
+            (g1 && (g1 == h0 || g1 == h1) && (g1 == i0 || g1 == i1));
+    }, exact, need);
+}
+
+// The statistics as one line for the work log
+std::string block_sampler::summary() const
+{
+    char line[128];
+    std::snprintf(line, sizeof(line), "Sequential tests read %.1f blocks per test; %lld of %lld tests counted exactly",
+        (double)this->blocks_read() / std::max(1LL, this->tests()), this->exact_tests(), this->tests());
+    return line;
+}
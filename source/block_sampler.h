@@ -0,0 +1,63 @@
+/********************************************************************
+* Defines sequential tests of the shared-block thresholds: blocks are
+* read in a fixed random order and the test stops as soon as the
+* share seen so far settles which side of the threshold it is on
+********************************************************************/
+
+#ifndef BLOCK_SAMPLER_H
+#define BLOCK_SAMPLER_H
+
+#include "poisson_pedigree.h"
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+// Blocks read before the first look at the sample
+#define SAMPLER_FIRST 64
+// Fraction of the genome past which the exact count is taken instead
+/// (a sampled block costs about as much as sixteen blocks of a vectorized count)
+#define SAMPLER_EXACT 0.0625
+// Seed of the block order
+#define SAMPLER_SEED 0x5EC7E57ull
+
+// A block_sampler answers `shared_blocks(...) >= need` for the couples
+// of one pedigree. The sample is looked at after SAMPLER_FIRST blocks
+// and every time its size doubles; at each look, the outcome is settled
+// if the share seen is further from the threshold than a Hoeffding-
+// Serfling margin, set so that the chance of a wrong outcome over all
+// looks is below the error bound. Undecided tests fall back to the
+// exact kernels.
+class block_sampler
+{
+private:
+    /// Order in which blocks are read, and the genome length
+    std::vector<int> order;
+    int num_blocks;
+    /// Sample sizes at which to look, and the margin at each
+    std::vector<int> looks;
+    std::vector<double> margin;
+    /// Tests run, blocks read by them, and tests that were counted exactly
+    mutable std::atomic<long long> num_test, num_read, num_exact;
+    // Decide the test given whether each block is shared, and the
+    // exact count to fall back on
+    template <typename F, typename E>
+    int decide(F hit, E exact, double need) const;
+public:
+    // Constructor
+    /// Given the genome length and the error bound of each test
+    block_sampler(int num_blocks, double error);
+    // Shared blocks of a pair, or of a triple (as in shared_blocks),
+    // if the outcome against need is settled by a sample: then an
+    // estimate on the same side of need as the exact count
+    int shared_blocks(coupled_node* u, coupled_node* v, double need) const;
+    int shared_blocks(coupled_node* u, coupled_node* v, coupled_node* w, double need) const;
+    // Statistics
+    long long tests() const { return this->num_test; }
+    long long blocks_read() const { return this->num_read; }
+    long long exact_tests() const { return this->num_exact; }
+    /// The statistics as one line for the work log
+    std::string summary() const;
+};
+
+#endif
@@ -0,0 +1,105 @@
+/********************************************************************
+* Implements the BP message cache
+********************************************************************/
+
+#include "bp_cache.h"
+
+#include <iterator>
+
+// Constructor
+/// Given the budget in bytes (0 for none)
+bp_cache::bp_cache(size_t budget) : budget(budget), used(0), hits(0), misses(0), evictions(0) {}
+
+// Destructor -- deletes the messages
+bp_cache::~bp_cache()
+{
+    for (entry& e : this->lru)
+        delete e.msg;
+}
+
+// Budget mutator
+size_t bp_cache::set_budget(size_t budget)
+{
+    std::lock_guard<std::mutex> lk(this->lock);
+    this->budget = budget;
+    this->evict();
+    return this->budget;
+}
+
+// Bytes held by the messages
+size_t bp_cache::bytes()
+{
+    std::lock_guard<std::mutex> lk(this->lock);
+    return this->used;
+}
+
+// Drop messages until within budget
+/// Walk from the least recently used end, skipping pinned messages and
+/// never dropping the newest, which its caller is about to read
+void bp_cache::evict()
+{
+    if (!this->budget || this->lru.empty())
+        return;
+    auto it = std::prev(this->lru.end());
+    while (this->used > this->budget && it != this->lru.begin()) {
+        auto prev = std::prev(it);
+        if (!it->pins) {
+            this->used -= it->bytes;
+            this->index.erase(it->key);
+            delete it->msg;
+            this->lru.erase(it);
+            this->evictions++;
+        }
+        it = prev;
+    }
+}
+
+// Whether the message of v at block b is cached
+bool bp_cache::contains(coupled_node* v, int b)
+{
+    std::lock_guard<std::mutex> lk(this->lock);
+    return this->index.count(key(v, b));
+}
+
+// Pin and return the message of v at block b (NULL if missing)
+bp_message* bp_cache::acquire(coupled_node* v, int b)
+{
+    std::lock_guard<std::mutex> lk(this->lock);
+    auto it = this->index.find(key(v, b));
+    if (it == this->index.end()) {
+        this->misses++;
+        return NULL;
+    }
+    this->hits++;
+    this->lru.splice(this->lru.begin(), this->lru, it->second);
+    it->second->pins++;
+    return it->second->msg;
+}
+
+// Unpin the message of v at block b
+void bp_cache::release(coupled_node* v, int b)
+{
+    std::lock_guard<std::mutex> lk(this->lock);
+    auto it = this->index.find(key(v, b));
+    if (it != this->index.end())
+        it->second->pins--;
+}
+
+// Take ownership of the message of v at block b (returns the cached one)
+/// Should another thread have cached the message first, its copy, which
+/// may be pinned, is kept and the new one deleted
+bp_message* bp_cache::insert(coupled_node* v, int b, bp_message* msg)
+{
+    std::lock_guard<std::mutex> lk(this->lock);
+    long long k = key(v, b);
+    auto it = this->index.find(k);
+    if (it != this->index.end()) {
+        delete msg;
+        return it->second->msg;
+    }
+    this->lru.push_front({ k, msg, msg->bytes(), 0 });
+    this->index[k] = this->lru.begin();
+    this->used += this->lru.front().bytes;
+    this->evict();
+    return msg;
+}
@@ -0,0 +1,68 @@
+/********************************************************************
+* Defines the BP message cache: the messages of every couple at every
+* block, kept within a byte budget by evicting the least recently used
+********************************************************************/
+
+#ifndef BP_CACHE_H
+#define BP_CACHE_H
+
+#include "bp_message.h"
+
+#include <unordered_map>
+#include <cstddef>
+#include <atomic>
+#include <mutex>
+#include <list>
+
+// The bp_cache class owns the BP messages of a pedigree, by couple and
+// block. While the messages take more than the budget, the least
+// recently used are evicted, to be recomputed when needed again. Pinned
+// messages, which are being read, and the newest message are kept.
+class bp_cache
+{
+private:
+    // Cached messages
+    struct entry
+    {
+        long long key;
+        bp_message* msg;
+        size_t bytes;
+        int pins;
+    };
+    /// Most recently used first
+    std::list<entry> lru;
+    std::unordered_map<long long, std::list<entry>::iterator> index;
+    // Byte budget (0 for none) and bytes held
+    size_t budget, used;
+    std::mutex lock;
+    // Key of couple v at block b
+    static long long key(coupled_node* v, int b) { return (long long)v->get_index() << 32 | (unsigned)b; }
+    // Drop messages until within budget
+    void evict();
+public:
+    // No copying
+    bp_cache(const bp_cache& other);
+    bp_cache& operator=(const bp_cache&);
+    // Counters
+    std::atomic<long long> hits, misses, evictions;
+    // Constructor
+    /// Given the budget in bytes (0 for none)
+    bp_cache(size_t budget);
+    // Destructor -- deletes the messages
+    ~bp_cache();
+    // Budget mutator
+    size_t set_budget(size_t budget);
+    // Bytes held by the messages
+    size_t bytes();
+    // Whether the message of v at block b is cached (neither counted as a
+    // hit or miss nor marked as used)
+    bool contains(coupled_node* v, int b);
+    // Pin and return the message of v at block b (NULL if missing)
+    bp_message* acquire(coupled_node* v, int b);
+    // Unpin the message of v at block b
+    void release(coupled_node* v, int b);
+    // Take ownership of the message of v at block b (returns the cached one)
+    bp_message* insert(coupled_node* v, int b, bp_message* msg);
+};
+
+#endif
@@ -8,6 +8,7 @@
 #include "bp_message.h"
 
 #include <algorithm>
+#include <iterator>
 
 /************************ DOMAIN ELEMENTS **************************/
 
@@ -30,117 +31,185 @@ bool bp_domain::operator<(const bp_domain& ot) const { return this->genes < ot.g
 
 /************************** BP MESSAGES ****************************/
 
-// Constructor
+// Local index of a gene, or -1 if it is outside of the local domain
+int bp_message::index_of(const gene& g) const
+{
+    auto it = std::lower_bound(this->genes.begin(), this->genes.end(), g);
+    return it == this->genes.end() || *it != g ? -1 : it - this->genes.begin();
+}
+
+/******************** MESSAGES OF A PRECISION **********************/
+
+// Constructors
 /// Construct a new message with all elements initialized to nullval
-bp_message::bp_message(long double nullval, int domain_sz)
+template <typename T>
+bp_message_of<T>::bp_message_of(T nullval, int domain_sz) : bp_message(domain_sz, std::vector<gene>())
+{
+    this->nullval = nullval;
+}
+/// Construct a new message over a local domain (in increasing order)
+template <typename T>
+bp_message_of<T>::bp_message_of(T nullval, int domain_sz, const std::vector<gene>& genes) : bp_message(domain_sz, genes)
 {
     this->nullval = nullval;
-    this->domain_sz = domain_sz;
+    this->probabilities.assign(genes.size() * (genes.size() + 1) / 2, nullval);
+    this->marginals.assign(genes.size(), nullval * domain_sz);
 }
 
-// Internal marginals mutator
-void bp_message::update_marginal(const gene &g, const long double &delta)
+// Internal helpers
+/// Add genes to the local domain, their pairs taking the default value
+template <typename T>
+void bp_message_of<T>::extend(const std::vector<gene>& genes)
 {
-    auto it = this->marginals.find(g);
-    if (it == this->marginals.end()) {
-        it = this->marginals.insert({g, nullval * domain_sz}).first;
-        this->unmapped.insert({g, domain_sz});
+    std::vector<gene> merged;
+    merged.reserve(this->genes.size() + genes.size());
+    std::set_union(this->genes.begin(), this->genes.end(), genes.begin(), genes.end(), std::back_inserter(merged));
+    if (merged.size() == this->genes.size())
+        return;
+    /// Move values over to their new local indices
+    std::vector<int> moved(this->genes.size());
+    for (int i = 0; i < this->genes.size(); i++)
+        moved[i] = std::lower_bound(merged.begin(), merged.end(), this->genes[i]) - merged.begin();
+    std::vector<T> marginals(merged.size(), this->nullval * this->domain_sz);
+    for (int i = 0; i < this->genes.size(); i++)
+        marginals[moved[i]] = this->marginals[i];
+    std::vector<T> probabilities;
+    if (!this->probabilities.empty()) {
+        probabilities.assign(merged.size() * (merged.size() + 1) / 2, this->nullval);
+        for (int i = 0; i < this->genes.size(); i++)
+            for (int j = i; j < this->genes.size(); j++)
+                probabilities[pair_index(moved[i], moved[j], merged.size())] =
+                    this->probabilities[this->pair_index(i, j)];
     }
-    it->second += delta;
+    this->genes.swap(merged);
+    this->marginals.swap(marginals);
+    this->probabilities.swap(probabilities);
 }
 
 // Set & access mapped values
-long double bp_message::operator[](const bp_domain& value) const
+template <typename T>
+T bp_message_of<T>::operator[](const bp_domain& value) const
 {
-    auto it = this->probabilities.find(value);
-    return it == this->probabilities.end() ? nullval : it->second;
+    int i = this->index_of(value[0]), j = this->index_of(value[1]);
+    return i < 0 || j < 0 ? this->nullval : this->at(i, j);
 }
-long double bp_message::get_marginal(const gene &value)
+template <typename T>
+T bp_message_of<T>::get_marginal(const gene &value) const
 {
-    auto it = this->marginals.find(value);
-    return it == this->marginals.end() ? nullval * domain_sz : it->second;
+    int i = this->index_of(value);
+    return i < 0 ? this->nullval * this->domain_sz : this->marginals[i];
 }
-void bp_message::inc(const bp_domain& value, const long double delta)
+template <typename T>
+void bp_message_of<T>::inc(const bp_domain& value, const T delta)
 {
-    bool new_value = false;
-    auto it = this->probabilities.find(value);
-    if (it == this->probabilities.end()) {
-        it = this->probabilities.insert({value, nullval}).first;
-        new_value = true;
+    /// Bring the genes into the local domain, and the pairs back after a purge
+    int i = this->index_of(value[0]), j = this->index_of(value[1]);
+    if (i < 0 || j < 0) {
+        this->extend(value[0] == value[1] ? std::vector<gene>{ value[0] } : std::vector<gene>{ value[0], value[1] });
+        i = this->index_of(value[0]), j = this->index_of(value[1]);
     }
-    update_marginal(value[0], delta);
-    update_marginal(value[1], delta);
-    it->second += delta;
-    this->unmapped.find(value[0])->second -= new_value;
-    this->unmapped.find(value[1])->second -= new_value;
+    this->inc_at(i, j, delta);
+}
+template <typename T>
+void bp_message_of<T>::inc_at(int i, int j, const T delta)
+{
+    if (this->probabilities.empty())
+        this->probabilities.assign(this->genes.size() * (this->genes.size() + 1) / 2, this->nullval);
+    this->probabilities[i <= j ? this->pair_index(i, j) : this->pair_index(j, i)] += delta;
+    this->marginals[i] += delta;
+    this->marginals[j] += delta;
 }
-void bp_message::set(const bp_domain &value, const long double prob)
+template <typename T>
+void bp_message_of<T>::set(const bp_domain &value, const T prob)
 { this->inc(value, prob - (*this)[value]); }
 
 // Arithmetic operations
 /// Add a message to this one
-bp_message& bp_message::operator+=(bp_message& other)
+template <typename T>
+bp_message_of<T>& bp_message_of<T>::operator+=(bp_message_of<T>& other)
 {
-    for (const auto &value : this->probabilities)
-        this->inc(value.first, other[value.first]);
-    for (const auto &value : other.probabilities)
-        if (this->probabilities.find(value.first) == this->probabilities.end())
-            this->inc(value.first, value.second);
+    this->extend(other.genes);
+    for (int i = 0; i < this->genes.size(); i++)
+        for (int j = i; j < this->genes.size(); j++)
+            this->inc(bp_domain(this->genes[i], this->genes[j]), other[bp_domain(this->genes[i], this->genes[j])]);
+    /// Pairs outside of the local domain gain the other default value
     this->nullval += other.nullval;
-    for (auto &value : this->marginals)
-        value.second += other.nullval * this->unmapped.find(value.first)->second;
+    for (T& marginal : this->marginals)
+        marginal += other.nullval * (T)(this->domain_sz - (int)this->genes.size() - 1);
     return *this;
 }
 /// Multiply this message by another
-bp_message& bp_message::operator*=(bp_message& other)
+template <typename T>
+bp_message_of<T>& bp_message_of<T>::operator*=(bp_message_of<T>& other)
 {
-    for (const auto &value : this->probabilities)
-        this->inc(value.first, (other[value.first] - 1) * value.second);
-    for (const auto value : other.probabilities)
-        if (this->probabilities.find(value.first) == this->probabilities.end())
-            this->inc(value.first, (value.second - 1) * nullval);
+    this->extend(other.genes);
+    for (int i = 0; i < this->genes.size(); i++)
+        for (int j = i; j < this->genes.size(); j++) {
+            bp_domain value(this->genes[i], this->genes[j]);
+            this->inc(value, (other[value] - 1) * (*this)[value]);
+        }
     this->nullval *= other.nullval;
     return *this;
 }
 /// Multiply this message by a constant
-bp_message& bp_message::operator*=(long double scalar)
+template <typename T>
+bp_message_of<T>& bp_message_of<T>::operator*=(T scalar)
 {
-    for (auto &value : this->probabilities)
-        value.second *= scalar;
-    for (auto &value : this->marginals)
-        value.second *= scalar;
+    for (T& value : this->probabilities)
+        value *= scalar;
+    for (T& value : this->marginals)
+        value *= scalar;
     this->nullval *= scalar;
     return *this;
 }
-bp_message& bp_message::operator/=(long double scalar) { return *this *= 1 / scalar; }
+template <typename T>
+bp_message_of<T>& bp_message_of<T>::operator/=(T scalar) { return *this *= 1 / scalar; }
 
 // Normalize this message for future use
-bp_message& bp_message::normalize()
+template <typename T>
+bp_message_of<T>& bp_message_of<T>::normalize()
 {
     /// Compute sum of probabilities
-    long double sum = 0;
-    for (auto value : this->probabilities)
-        sum += value.second;
-    sum += this->nullval * (domain_sz * domain_sz - this->probabilities.size());
+    T sum = 0;
+    for (T value : this->probabilities)
+        sum += value;
+    sum += this->nullval * ((T)this->domain_sz * this->domain_sz - this->probabilities.size());
     /// Divide by total sum
     return *this /= sum;
 }
 
 // Purge pairs from memory, keeping only marginals
-bp_message& bp_message::purge()
+template <typename T>
+bp_message& bp_message_of<T>::purge()
 {
-    this->probabilities.clear();
+    std::vector<T>().swap(this->probabilities);
     this->nullval = 0;
     return *this;
 }
 
 // Extract maximum-probability domain element
-bp_domain bp_message::extract_max()
+template <typename T>
+bp_domain bp_message_of<T>::extract_max() const
 {
     bp_domain max(1, 2);
-    long double max_prop = 0;
-    for (auto weight : this->probabilities)
-        if (weight.second > max_prop)
-            max = weight.first, max_prop = weight.second;
+    T max_prop = 0;
+    size_t at = 0;
+    for (int i = 0; i < this->genes.size() && !this->probabilities.empty(); i++)
+        for (int j = i; j < this->genes.size(); j++, at++)
+            if (this->probabilities[at] > max_prop)
+                max = bp_domain(this->genes[i], this->genes[j]), max_prop = this->probabilities[at];
     return max;
 }
+
+// Memory held by the message
+template <typename T>
+size_t bp_message_of<T>::bytes() const
+{
+    return sizeof(*this) + this->genes.capacity() * sizeof(gene) +
+        (this->probabilities.capacity() + this->marginals.capacity()) * sizeof(T);
+}
+
+// The precisions REC-GEN may run BP in
+template struct bp_message_of<float>;
+template struct bp_message_of<double>;
+template struct bp_message_of<long double>;
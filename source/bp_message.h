@@ -10,7 +10,7 @@
 
 #include "poisson_pedigree.h"
 
-#include <map>
+#include <vector>
 
 // Use a canonic form of gene pairs as domain elements of the marginals
 // for BP messages
@@ -31,46 +31,97 @@ public:
 };
 
 // Representation of messages for BP algorithm
+/// Genes are remapped to a dense local domain: the genes the message was
+/// made for (or has since been given), in increasing order. Pairs of local
+/// genes are kept in a packed upper triangle, and every pair outside the
+/// local domain holds the default value. Messages of every precision share
+/// this base, through which couples own them
 struct bp_message
 {
-private:
-    // Private members
-    /// Represent non-default values with a map
-    std::map<bp_domain, long double> probabilities;
-    /// Represent total probabilities per half-value
-    std::map<gene, long double> marginals;
-    /// Represent number of unassigned domain elements
-    std::map<gene, int> unmapped;
-    /// Set default value at initialization time
-    long double nullval;
+protected:
+    // Protected members
+    /// Local domain, in increasing order
+    std::vector<gene> genes;
     /// Set domain size (per gene) at initialization time
     int domain_sz;
-    // Internal mutation functions
-    void update_marginal(const gene& g, const long double& delta);
+    // Internal helpers
+    /// Position of local pair (i, j), i <= j, in a triangle over n genes
+    static size_t pair_index(int i, int j, size_t n) { return (size_t)i * (2 * n - i + 1) / 2 + (j - i); }
+    size_t pair_index(int i, int j) const { return pair_index(i, j, this->genes.size()); }
 public:
     // Constructor
+    bp_message(int domain_sz, const std::vector<gene>& genes) : genes(genes), domain_sz(domain_sz) {}
+    // Destructor
+    virtual ~bp_message() {}
+    // Local domain
+    int num_genes() const { return this->genes.size(); }
+    const gene& local_gene(int i) const { return this->genes[i]; }
+    /// Local index of a gene, or -1 if it is outside of the local domain
+    int index_of(const gene& g) const;
+    // Access, whatever the precision
+    virtual long double value(const bp_domain& value) const = 0;
+    // Purge pairs from memory, keeping only marginals
+    virtual bp_message& purge() = 0;
+    // Extract maximum value
+    virtual bp_domain extract_max() const = 0;
+    // Memory held by the message
+    virtual size_t bytes() const = 0;
+};
+
+// Messages holding their probabilities as T (float, double or long double)
+template <typename T>
+struct bp_message_of : public bp_message
+{
+private:
+    // Private members
+    /// Pair probabilities, upper triangle packed row by row
+    std::vector<T> probabilities;
+    /// Total probabilities per local gene
+    std::vector<T> marginals;
+    /// Set default value at initialization time
+    T nullval;
+    // Internal helpers
+    /// Add genes to the local domain, their pairs taking the default value
+    void extend(const std::vector<gene>& genes);
+public:
+    // Constructors
     /// Construct a new message with all elements initialized to nullval
-    bp_message(long double nullval, int domain_sz);
+    bp_message_of(T nullval, int domain_sz);
+    /// Construct a new message over a local domain (in increasing order)
+    bp_message_of(T nullval, int domain_sz, const std::vector<gene>& genes);
+    /// Values by local index
+    T at(int i, int j) const
+    {
+        if (this->probabilities.empty())
+            return this->nullval;
+        return i <= j ? this->probabilities[this->pair_index(i, j)] : this->probabilities[this->pair_index(j, i)];
+    }
+    T marginal_at(int i) const { return this->marginals[i]; }
     // Set & access mapped values
-    long double operator[](const bp_domain& value) const;
-    long double get_marginal(const gene& value);
-    void inc(const bp_domain& value, const long double delta);
-    void set(const bp_domain& value, const long double prob);
+    T operator[](const bp_domain& value) const;
+    T get_marginal(const gene& value) const;
+    T get_nullval() const { return this->nullval; }
+    long double value(const bp_domain& value) const { return (*this)[value]; }
+    void inc_at(int i, int j, const T delta);
+    void inc(const bp_domain& value, const T delta);
+    void set(const bp_domain& value, const T prob);
     // Arithmetic operations
     /// Add a message to this one
-    bp_message& operator+=(bp_message& other);
+    bp_message_of& operator+=(bp_message_of& other);
     /// Multiply this message by another
-    bp_message& operator*=(bp_message& other);
+    bp_message_of& operator*=(bp_message_of& other);
     /// Multiply this message by a constant
-    bp_message& operator*=(long double scalar);
+    bp_message_of& operator*=(T scalar);
     /// Divide this message by a constant
-    bp_message& operator/=(long double scalar);
+    bp_message_of& operator/=(T scalar);
     // Normalize this message for future use
-    bp_message& normalize();
+    bp_message_of& normalize();
     // Purge pairs from memory, keeping only marginals
     bp_message& purge();
     // Extract maximum value
-    bp_domain extract_max();
+    bp_domain extract_max() const;
+    // Memory held by the message
+    size_t bytes() const;
 };
 
 #endif
@@ -0,0 +1,109 @@
+/********************************************************************
+* Implements descendant sets
+********************************************************************/
+
+#include "desc_set.h"
+
+#include <algorithm>
+#include <iterator>
+
+// Constructors
+/// Empty
+desc_set::desc_set() : dense(false), count(0) {}
+/// Holding one index
+desc_set::desc_set(uint32_t index) : members(1, index), dense(false), count(1) {}
+
+// Switch to the representation that suits the size of the set
+/// An index costs 32 bits in an array and a bitset costs one bit per
+/// index up to the largest, so sets denser than 1/32 become bitsets
+void desc_set::normalize()
+{
+    if (!this->dense && !this->members.empty() && (size_t)this->count * 32 > this->members.back()) {
+        this->words.assign(this->members.back() / DESC_SET_WORD + 1, 0);
+        for (uint32_t i : this->members)
+            this->words[i / DESC_SET_WORD] |= 1ull << i % DESC_SET_WORD;
+        this->members = std::vector<uint32_t>();
+        this->dense = true;
+    }
+    else if (this->dense && (size_t)this->count * 32 <= this->words.size() * DESC_SET_WORD) {
+        std::vector<uint32_t> members;
+        members.reserve(this->count);
+        this->for_each([&](uint32_t i) { members.push_back(i); });
+        this->members.swap(members);
+        this->words = std::vector<uint64_t>();
+        this->dense = false;
+    }
+}
+
+// Add the indices of another set (returns self)
+desc_set* desc_set::merge(const desc_set& other)
+{
+    if (!this->dense && !other.dense) {
+        std::vector<uint32_t> members;
+        members.reserve(this->members.size() + other.members.size());
+        std::set_union(this->members.begin(), this->members.end(), other.members.begin(), other.members.end(),
+            std::back_inserter(members));
+        this->members.swap(members);
+        this->count = this->members.size();
+    }
+    else {
+        /// Work on bitsets, then count
+        if (!this->dense) {
+            this->words.assign(this->members.empty() ? 0 : this->members.back() / DESC_SET_WORD + 1, 0);
+            for (uint32_t i : this->members)
+                this->words[i / DESC_SET_WORD] |= 1ull << i % DESC_SET_WORD;
+            this->members = std::vector<uint32_t>();
+            this->dense = true;
+        }
+        if (other.dense) {
+            if (this->words.size() < other.words.size())
+                this->words.resize(other.words.size(), 0);
+            for (size_t w = 0; w < other.words.size(); w++)
+                this->words[w] |= other.words[w];
+        }
+        else {
+            if (!other.members.empty() && this->words.size() <= other.members.back() / DESC_SET_WORD)
+                this->words.resize(other.members.back() / DESC_SET_WORD + 1, 0);
+            for (uint32_t i : other.members)
+                this->words[i / DESC_SET_WORD] |= 1ull << i % DESC_SET_WORD;
+        }
+        this->count = 0;
+        for (uint64_t m : this->words)
+            this->count += __builtin_popcountll(m);
+    }
+    this->normalize();
+    return this;
+}
+
+// Remove the indices of another set (returns self)
+desc_set* desc_set::subtract(const desc_set& other)
+{
+    if (!this->dense) {
+        auto end = std::remove_if(this->members.begin(), this->members.end(),
+            [&](uint32_t i) { return other.contains(i); });
+        this->members.erase(end, this->members.end());
+        this->count = this->members.size();
+    }
+    else {
+        if (other.dense)
+            for (size_t w = 0; w < std::min(this->words.size(), other.words.size()); w++)
+                this->words[w] &= ~other.words[w];
+        else
+            for (uint32_t i : other.members)
+                if (i / DESC_SET_WORD < this->words.size())
+                    this->words[i / DESC_SET_WORD] &= ~(1ull << i % DESC_SET_WORD);
+        this->count = 0;
+        for (uint64_t m : this->words)
+            this->count += __builtin_popcountll(m);
+    }
+    this->normalize();
+    return this;
+}
+
+// Query whether an index is in the set
+bool desc_set::contains(uint32_t index) const
+{
+    if (this->dense)
+        return index / DESC_SET_WORD < this->words.size() && (this->words[index / DESC_SET_WORD] >> index % DESC_SET_WORD & 1);
+    return std::binary_search(this->members.begin(), this->members.end(), index);
+}
@@ -0,0 +1,62 @@
+/********************************************************************
+* Defines descendant sets: sets of extant individuals, identified by
+* their indices in the node arena of their pedigree, kept compact
+* whether they hold a handful of individuals or most of a grade
+********************************************************************/
+
+#ifndef DESC_SET_H
+#define DESC_SET_H
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+// Bits per word of a dense set
+#define DESC_SET_WORD 64
+
+// A desc_set is a set of individual indices, kept as a sorted array
+// while that is smaller than a bitset over the indices up to its
+// largest, and as a bitset afterwards
+struct desc_set
+{
+private:
+    // Private members
+    /// Sorted indices, for a sparse set
+    std::vector<uint32_t> members;
+    /// Bitset over indices, for a dense set
+    std::vector<uint64_t> words;
+    bool dense;
+    int count;
+    // Private methods
+    /// Switch to the representation that suits the size of the set
+    void normalize();
+public:
+    // Constructors
+    /// Empty
+    desc_set();
+    /// Holding one index
+    desc_set(uint32_t index);
+    // Set operations (return self)
+    /// Add the indices of another set
+    desc_set* merge(const desc_set& other);
+    /// Remove the indices of another set
+    desc_set* subtract(const desc_set& other);
+    // Queries
+    int size() const { return this->count; }
+    bool contains(uint32_t index) const;
+    // Call f on every index, in increasing order
+    template <typename F>
+    void for_each(F f) const
+    {
+        if (!this->dense) {
+            for (uint32_t i : this->members)
+                f(i);
+            return;
+        }
+        for (size_t w = 0; w < this->words.size(); w++)
+            for (uint64_t m = this->words[w]; m; m &= m - 1)
+                f((uint32_t)(w * DESC_SET_WORD + __builtin_ctzll(m)));
+    }
+};
+
+#endif
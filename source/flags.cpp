@@ -7,6 +7,7 @@
 
 #include "flags.h"
 #include <sstream>
+#include <cctype>
 
 // Add new flag to nickname map and effects map
 void flag_reader::add_flag(std::string name, char nick, int narg, std::function<void(std::vector<std::string>,void*)> eff)
@@ -120,3 +121,15 @@ std::vector<std::string> split_opts(std::string s)
     }
     return opts;
 }
+
+// Parse a byte count, with an optional K, M, G or T suffix
+long long parse_bytes(std::string s)
+{
+    size_t end;
+    long double n = std::stold(s, &end);
+    std::string units = "KMGT";
+    size_t u = end < s.size() ? units.find(toupper(s[end])) : std::string::npos;
+    for (size_t i = 0; u != std::string::npos && i <= u; i++)
+        n *= 1024;
+    return n;
+}
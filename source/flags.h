@@ -45,5 +45,7 @@ public:
 
 // Split string on commas
 std::vector<std::string> split_opts(std::string s);
+// Parse a byte count, with an optional K, M, G or T suffix
+long long parse_bytes(std::string s);
 
 #endif
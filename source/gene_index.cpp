@@ -0,0 +1,46 @@
+/********************************************************************
+* Implements gene indices
+********************************************************************/
+
+#include "gene_index.h"
+
+#include <utility>
+
+// Construct the index of a grade
+/// Each block's (gene, couple) pairs are sorted once; a couple carrying
+/// the same gene twice is listed once
+gene_index::gene_index(const std::vector<coupled_node*>& grade, int num_blocks)
+{
+    std::vector<std::pair<gene, uint32_t>> entries;
+    this->key_start.push_back(0);
+    this->post_start.push_back(0);
+    for (int b = 0; b < num_blocks; b++) {
+        entries.clear();
+        for (uint32_t i = 0; i < grade.size(); i++) {
+            gene g0 = (*(*grade[i])[0])[b], g1 = (*(*grade[i])[1])[b];
+            if (g0)
+                entries.push_back({ g0, i });
+            if (g1 && g1 != g0)
+                entries.push_back({ g1, i });
+        }
+        std::sort(entries.begin(), entries.end());
+        for (size_t e = 0; e < entries.size(); e++) {
+            if (!e || entries[e].first != entries[e - 1].first) {
+                if (e)
+                    this->post_start.push_back(this->post.size());
+                this->keys.push_back(entries[e].first);
+            }
+            this->post.push_back(entries[e].second);
+        }
+        if (!entries.empty())
+            this->post_start.push_back(this->post.size());
+        this->key_start.push_back(this->keys.size());
+    }
+}
+
+// Bytes held by the index
+size_t gene_index::mem_usage() const
+{
+    return this->keys.capacity() * sizeof(gene) + this->key_start.capacity() * sizeof(size_t) +
+        this->post.capacity() * sizeof(uint32_t) + this->post_start.capacity() * sizeof(size_t);
+}
@@ -0,0 +1,50 @@
+/********************************************************************
+* Defines gene indices: inverted indices from (block, gene) to the
+* couples of a grade carrying that gene at that block
+********************************************************************/
+
+#ifndef GENE_INDEX_H
+#define GENE_INDEX_H
+
+#include "poisson_pedigree.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+// A gene_index lists, for every block and every non-zero gene found at
+// that block, the indices (into the grade it was built from) of the
+// couples with a member carrying the gene, in increasing order
+class gene_index
+{
+private:
+    /// Genes of each block, sorted: those of block b are keys from
+    /// key_start[b] to key_start[b + 1]
+    std::vector<gene> keys;
+    std::vector<size_t> key_start;
+    /// Couples of each key: those of key i are post from post_start[i]
+    /// to post_start[i + 1]
+    std::vector<uint32_t> post;
+    std::vector<size_t> post_start;
+public:
+    // Constructor
+    /// Given the couples of a grade and the number of blocks
+    gene_index(const std::vector<coupled_node*>& grade, int num_blocks);
+    // Call f on the index of every couple carrying g at block b
+    template <typename F>
+    void for_each(int b, gene g, F f) const
+    {
+        auto first = this->keys.begin() + this->key_start[b], last = this->keys.begin() + this->key_start[b + 1];
+        auto it = std::lower_bound(first, last, g);
+        if (it == last || *it != g)
+            return;
+        size_t i = it - this->keys.begin();
+        for (size_t p = this->post_start[i]; p < this->post_start[i + 1]; p++)
+            f(this->post[p]);
+    }
+    // Bytes held by the index
+    size_t mem_usage() const;
+};
+
+#endif
@@ -0,0 +1,196 @@
+/********************************************************************
+* Implements the genome store: a contiguous matrix holding the
+* genomes of many individuals (typically one grade of a pedigree),
+* packed at the narrowest gene width that fits every value stored
+* in it, or as runs of equal genes
+********************************************************************/
+
+#include "genome_store.h"
+
+#include <algorithm>
+#include <cstring>
+
+// Construct an empty store given the genome length, the largest gene
+// expected, and the layout
+genome_store::genome_store(int genome_len, gene max_gene, int layout)
+{
+    this->data = NULL;
+    this->genome_len = genome_len;
+    this->width = genome_store::width_for(max_gene);
+    this->layout = layout;
+    this->num_slot = this->cap_slot = 0;
+    this->owns_data = true;
+    this->fixed_width = false;
+}
+// Wrap a filled individual-major matrix without copying it
+genome_store::genome_store(int genome_len, int width, int num_slot, void* data)
+{
+    this->data = static_cast<unsigned char*>(data);
+    this->genome_len = genome_len;
+    this->width = width;
+    this->layout = GENOME_INDIV_MAJOR;
+    this->num_slot = this->cap_slot = num_slot;
+    this->owns_data = false;
+    this->fixed_width = false;
+}
+
+// Destructor
+genome_store::~genome_store()
+{
+    if (this->owns_data)
+        delete[] this->data;
+}
+
+// Reallocate the matrix with a new gene width and slot capacity,
+// copying over all assigned genes
+void genome_store::repack(int width, int cap_slot)
+{
+    unsigned char* old_data = this->data;
+    int old_width = this->width, old_cap = this->cap_slot;
+    bool old_owned = this->owns_data;
+    this->data = new unsigned char[(size_t)width * cap_slot * this->genome_len]();
+    this->width = width;
+    this->cap_slot = cap_slot;
+    this->owns_data = true;
+    if (old_data == NULL)
+        return;
+    /// Individual-major rows keep their offsets, so a same-width copy is a memcpy
+    if (this->layout == GENOME_INDIV_MAJOR && old_width == width)
+        std::memcpy(this->data, old_data, (size_t)width * this->num_slot * this->genome_len);
+    /// Otherwise re-read every gene at the old width and stride
+    else {
+        genome_store old(this->genome_len, 0, this->layout);
+        old.data = old_data, old.width = old_width, old.cap_slot = old_cap, old.owns_data = old_owned;
+        for (int s = 0; s < this->num_slot; s++)
+            for (int b = 0; b < this->genome_len; b++)
+                this->set(s, b, old.get(s, b));
+        return;
+    }
+    if (old_owned)
+        delete[] old_data;
+}
+
+// Allocate a new zeroed genome and return its slot
+int genome_store::alloc()
+{
+    /// A segmented genome starts as one run of zeros
+    if (this->layout == GENOME_SEGMENTS) {
+        this->runs.push_back({ { 0, 0 } });
+        return this->num_slot++;
+    }
+    /// Grow geometrically so that repeated allocation is amortized linear
+    if (this->num_slot == this->cap_slot)
+        this->repack(this->width, std::max(4, 2 * this->cap_slot));
+    return this->num_slot++;
+}
+
+// Fix the gene width
+genome_store* genome_store::fix_width()
+{
+    this->fixed_width = true;
+    return this;
+}
+
+// Runs of segmented slots
+/// Run holding block b
+const genome_segment* genome_store::run_at(int slot, int b) const
+{
+    const std::vector<genome_segment>& r = this->runs[slot];
+    return std::upper_bound(r.begin(), r.end(), b, [](int b, const genome_segment& s) { return b < s.start; }) - 1 - r.begin() + r.data();
+}
+/// Write a gene, splitting the run holding b around it and merging
+/// equal neighbours
+void genome_store::set_run(int slot, int b, gene g)
+{
+    std::vector<genome_segment>& r = this->runs[slot];
+    size_t i = this->run_at(slot, b) - r.data();
+    if (r[i].g == g)
+        return;
+    int end = i + 1 < r.size() ? r[i + 1].start : this->genome_len;
+    if (end > b + 1)
+        r.insert(r.begin() + i + 1, { b + 1, r[i].g });
+    if (r[i].start < b)
+        r.insert(r.begin() + ++i, { b, g });
+    else
+        r[i].g = g;
+    if (i + 1 < r.size() && r[i + 1].g == g)
+        r.erase(r.begin() + i + 1);
+    if (i > 0 && r[i - 1].g == g)
+        r.erase(r.begin() + i);
+}
+
+// Gene of the run holding block b, and the first block past the run
+gene genome_store::run(int slot, int b, int& end) const
+{
+    if (this->layout != GENOME_SEGMENTS) {
+        end = b + 1;
+        return this->get(slot, b);
+    }
+    const genome_segment* s = this->run_at(slot, b);
+    end = s + 1 < this->runs[slot].data() + this->runs[slot].size() ? s[1].start : this->genome_len;
+    return s->g;
+}
+
+// Copy blocks [from, to) of a slot of another store into a slot
+/// When both stores are segmented and the slot is filled up to from,
+/// the runs of the source are sliced onto the end of the slot
+void genome_store::copy_range(int slot, const genome_store& src, int src_slot, int from, int to)
+{
+    if (this->layout != GENOME_SEGMENTS || src.layout != GENOME_SEGMENTS || this->runs[slot].back().start > from) {
+        for (int b = from; b < to; b++)
+            this->set(slot, b, src.get(src_slot, b));
+        return;
+    }
+    std::vector<genome_segment>& r = this->runs[slot];
+    const std::vector<genome_segment>& s = src.runs[src_slot];
+    auto append = [&](int start, gene g) {
+        if (r.empty() || r.back().g != g)
+            r.push_back({ start, g });
+    };
+    /// Cut the last run at from, keeping its gene for the blocks past to
+    gene tail = r.back().g;
+    if (r.back().start == from)
+        r.pop_back();
+    for (size_t i = src.run_at(src_slot, from) - s.data(); i < s.size() && s[i].start < to; i++)
+        append(std::max(from, s[i].start), s[i].g);
+    if (to < this->genome_len)
+        append(to, tail);
+}
+
+// Genome of a slot: its first gene, with consecutive blocks
+// block_stride() genes apart
+const void* genome_store::row(int slot) const
+{ return this->layout == GENOME_SEGMENTS ? NULL : this->data + this->index(slot, 0) * this->width; }
+size_t genome_store::block_stride() const
+{ return this->layout == GENOME_BLOCK_MAJOR ? this->cap_slot : 1; }
+/// Runs of a slot of a segmented store
+const std::vector<genome_segment>& genome_store::segments(int slot) const { return this->runs[slot]; }
+/// The whole matrix, mem_usage() bytes long
+const void* genome_store::matrix() const { return this->data; }
+
+// Statistic accessors
+int genome_store::num_blocks() const { return this->genome_len; }
+int genome_store::bytes_per_gene() const { return this->width; }
+int genome_store::get_layout() const { return this->layout; }
+int genome_store::size() const { return this->num_slot; }
+size_t genome_store::mem_usage() const
+{
+    if (this->layout != GENOME_SEGMENTS)
+        return (size_t)this->width * this->cap_slot * this->genome_len;
+    size_t bytes = 0;
+    for (const std::vector<genome_segment>& r : this->runs)
+        bytes += r.capacity() * sizeof(genome_segment);
+    return bytes;
+}
+
+// Smallest gene width (in bytes) that holds max_gene
+int genome_store::width_for(gene max_gene)
+{
+    if (max_gene <= UINT8_MAX)
+        return 1;
+    if (max_gene <= UINT16_MAX)
+        return 2;
+    if (max_gene <= UINT32_MAX)
+        return 4;
+    return 8;
+}
@@ -0,0 +1,166 @@
+/********************************************************************
+* Defines the genome store: a contiguous matrix holding the genomes
+* of many individuals (typically one grade of a pedigree), packed at
+* the narrowest gene width that fits every value stored in it, or as
+* runs of equal genes
+********************************************************************/
+
+#ifndef GENOME_STORE_H
+#define GENOME_STORE_H
+
+#include <cassert>
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+// We represent a gene as a long long unsigned integer
+// Permissible values: 0 - 18,446,744,073,709,551,615
+typedef long long unsigned gene;
+
+// Layouts of the genome matrix
+/// Each individual's genome is one contiguous row (good for comparing
+/// whole genomes of a few individuals, e.g. shared-block counting)
+#define GENOME_INDIV_MAJOR 0
+/// Each block is one contiguous row over all individuals (good for
+/// scanning one block across a whole grade, e.g. symbol collection)
+#define GENOME_BLOCK_MAJOR 1
+/// Each genome is a list of runs of equal genes (good for genomes
+/// inherited in long segments: storage is O(crossovers), not O(blocks))
+#define GENOME_SEGMENTS 2
+
+// A run of equal genes, from block start up to the start of the next run
+// (or the end of the genome)
+struct genome_segment
+{
+    int start;
+    gene g;
+};
+
+// A genome store owns the genes of a set of individuals, each of which
+// is identified by a slot index. Genes are stored 1, 2, 4 or 8 bytes
+// wide; the width is picked from the largest gene expected and grows
+// automatically if a larger gene is ever written, until the width is
+// fixed. Segmented stores keep a list of runs per slot instead of a
+// matrix.
+struct genome_store
+{
+private:
+    // Private members
+    /// Raw gene matrix
+    unsigned char* data;
+    /// Number of blocks per genome
+    int genome_len;
+    /// Bytes per gene (1, 2, 4 or 8)
+    int width;
+    /// One of GENOME_INDIV_MAJOR or GENOME_BLOCK_MAJOR
+    int layout;
+    /// Number of slots handed out and number of slots allocated
+    int num_slot, cap_slot;
+    /// Whether the matrix was allocated by the store (false if borrowed)
+    bool owns_data;
+    /// Whether the gene width may no longer grow
+    bool fixed_width;
+    /// Runs of each slot, for a segmented store
+    std::vector<std::vector<genome_segment>> runs;
+    // Private methods
+    /// Reallocate the matrix with a new gene width and slot capacity
+    void repack(int width, int cap_slot);
+    /// Index of a gene in the matrix
+    size_t index(int slot, int b) const
+    { return this->layout == GENOME_BLOCK_MAJOR ? (size_t)b * this->cap_slot + slot : (size_t)slot * this->genome_len + b; }
+    /// Run of a segmented slot holding block b
+    const genome_segment* run_at(int slot, int b) const;
+    /// Write a gene of a segmented slot, splitting and merging runs
+    void set_run(int slot, int b, gene g);
+public:
+    // No copying
+    genome_store(const genome_store& other);
+    genome_store& operator=(const genome_store&);
+    // Constructor
+    /// Given the genome length, the largest gene expected, and the layout
+    genome_store(int genome_len, gene max_gene, int layout);
+    /// Wrap a filled individual-major matrix of num_slot genomes without
+    /// copying it (e.g. a memory-mapped file); the store never frees the
+    /// matrix and copies it out if it ever has to grow
+    genome_store(int genome_len, int width, int num_slot, void* data);
+    // Destructor
+    ~genome_store();
+    // Allocate a new zeroed genome and return its slot
+    int alloc();
+    // Fix the gene width, so that set() never reallocates the matrix and
+    // writers to distinct genes may run concurrently (returns self)
+    genome_store* fix_width();
+    // Access and modify genes
+    gene get(int slot, int b) const
+    {
+        if (this->layout == GENOME_SEGMENTS)
+            return this->run_at(slot, b)->g;
+        size_t i = this->index(slot, b);
+        switch (this->width) {
+            case 1: return this->data[i];
+            case 2: return reinterpret_cast<uint16_t*>(this->data)[i];
+            case 4: return reinterpret_cast<uint32_t*>(this->data)[i];
+            default: return reinterpret_cast<uint64_t*>(this->data)[i];
+        }
+    }
+    void set(int slot, int b, gene g)
+    {
+        if (this->layout == GENOME_SEGMENTS) {
+            this->set_run(slot, b, g);
+            return;
+        }
+        /// Widen the store if the gene does not fit, which a store with a
+        /// fixed width must never need
+        if (this->width < 8 && g >> 8 * this->width) {
+            assert(!this->fixed_width && "gene wider than the fixed width of its genome store");
+            this->repack(genome_store::width_for(g), this->cap_slot);
+        }
+        size_t i = this->index(slot, b);
+        switch (this->width) {
+            case 1: this->data[i] = g; break;
+            case 2: reinterpret_cast<uint16_t*>(this->data)[i] = g; break;
+            case 4: reinterpret_cast<uint32_t*>(this->data)[i] = g; break;
+            default: reinterpret_cast<uint64_t*>(this->data)[i] = g; break;
+        }
+    }
+    /// Gene of the run holding block b; end is set to the first block
+    /// past the run (b + 1 unless the store is segmented)
+    gene run(int slot, int b, int& end) const;
+    /// Copy blocks [from, to) of a slot of another store into a slot;
+    /// between segmented stores, copies filling a slot in order slice
+    /// whole runs
+    void copy_range(int slot, const genome_store& src, int src_slot, int from, int to);
+    /// Genome of a slot: its first gene, with consecutive blocks
+    /// block_stride() genes apart (NULL for a segmented store)
+    const void* row(int slot) const;
+    size_t block_stride() const;
+    /// Runs of a slot of a segmented store
+    const std::vector<genome_segment>& segments(int slot) const;
+    /// The whole matrix, mem_usage() bytes long (NULL for a segmented store)
+    const void* matrix() const;
+    // Statistic accessors
+    int num_blocks() const;
+    int bytes_per_gene() const;
+    int get_layout() const;
+    int size() const;
+    /// Bytes held by the gene matrix or runs
+    size_t mem_usage() const;
+    // Smallest gene width (in bytes) that holds max_gene
+    static int width_for(gene max_gene);
+};
+
+// A modifiable reference to one gene of one individual in a store;
+// behaves like a gene& for reading and assignment
+struct gene_ref
+{
+private:
+    genome_store* store;
+    int slot, b;
+public:
+    gene_ref(genome_store* store, int slot, int b) : store(store), slot(slot), b(b) {}
+    operator gene() const { return this->store->get(this->slot, this->b); }
+    gene_ref& operator=(gene g) { this->store->set(this->slot, this->b, g); return *this; }
+    gene_ref& operator=(const gene_ref& ot) { return *this = (gene)ot; }
+};
+
+#endif
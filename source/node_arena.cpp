@@ -0,0 +1,31 @@
+/********************************************************************
+* Implements node arenas
+********************************************************************/
+
+#include "node_arena.h"
+#include "poisson_pedigree.h"
+
+// Nodes made outside of any pedigree go to a default arena that lasts as
+// long as the program
+static node_arena default_arena;
+node_arena* node_arena::active = &default_arena;
+
+// Destroy every node in the arena
+/// Couples first let go of their children, so that individuals do not
+/// touch couples that are already gone
+node_arena::~node_arena()
+{
+    for (int i = 0; i < this->couples.size(); i++)
+        if (this->couples[i])
+            this->couples[i]->purge();
+    for (int i = 0; i < this->indivs.size(); i++)
+        if (this->indivs[i])
+            this->indivs[i]->purge()->~individual_node();
+    for (int i = 0; i < this->couples.size(); i++)
+        if (this->couples[i])
+            this->couples[i]->~coupled_node();
+    for (individual_node** children : this->child_arrays)
+        delete[] children;
+    if (node_arena::active == this)
+        node_arena::active = &default_arena;
+}
@@ -0,0 +1,145 @@
+/********************************************************************
+* Defines node arenas: every pedigree owns one, from which its
+* individual and coupled nodes are allocated, and through which they
+* are numbered densely and found by ID
+********************************************************************/
+
+#ifndef NODE_ARENA_H
+#define NODE_ARENA_H
+
+#include <unordered_map>
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+struct individual_node;
+struct coupled_node;
+
+// Nodes are carved out of slabs holding this many nodes each
+#define NODE_ARENA_SLAB 1024
+// IDs smaller than this many times the number of nodes (plus one slab)
+// are found through a flat table; larger, sparse IDs through a hash map
+#define NODE_ARENA_DENSE 4
+
+// A node_pool keeps the nodes of one type in an arena
+template <typename T>
+class node_pool
+{
+private:
+    /// Raw storage, and the number of nodes carved from the last slab
+    std::vector<char*> slabs;
+    int carved;
+    /// Nodes by dense index, in order of construction (NULL once deleted)
+    std::vector<T*> nodes;
+    /// Nodes by ID
+    std::vector<T*> dense;
+    std::unordered_map<long long, T*> sparse;
+    long long id_max;
+public:
+    // No copying
+    node_pool(const node_pool& other);
+    node_pool& operator=(const node_pool&);
+    // Constructor
+    node_pool() : carved(NODE_ARENA_SLAB), id_max(0) {}
+    // Destructor -- frees the storage, but does not destroy the nodes
+    ~node_pool()
+    {
+        for (char* slab : this->slabs)
+            ::operator delete(slab);
+    }
+    // Storage for one more node
+    void* alloc()
+    {
+        if (this->carved == NODE_ARENA_SLAB) {
+            this->slabs.push_back(static_cast<char*>(::operator new(sizeof(T) * NODE_ARENA_SLAB)));
+            this->carved = 0;
+        }
+        return this->slabs.back() + sizeof(T) * this->carved++;
+    }
+    // Number a newly constructed node (returns its dense index)
+    int enroll(T* node)
+    {
+        this->nodes.push_back(node);
+        return this->nodes.size() - 1;
+    }
+    // Forget a deleted node
+    void release(T* node, int index, long long id)
+    {
+        this->nodes[index] = NULL;
+        this->unmap(node, id);
+    }
+    // Nodes by dense index
+    int size() { return this->nodes.size(); }
+    T* operator[](int index) { return this->nodes[index]; }
+    // IDs
+    /// The next unused ID
+    long long next_id() { return this->id_max + 1; }
+    /// Find the node with an ID (NULL if there is none)
+    T* find(long long id)
+    {
+        if (0 <= id && id < this->dense.size() && this->dense[id])
+            return this->dense[id];
+        if (this->sparse.empty())
+            return NULL;
+        auto it = this->sparse.find(id);
+        return it == this->sparse.end() ? NULL : it->second;
+    }
+    /// Give an ID to a node; a node already holding the ID keeps it
+    void map(T* node, long long id)
+    {
+        this->id_max = this->id_max < id ? id : this->id_max;
+        if (this->find(id))
+            return;
+        if (0 <= id && id >= this->dense.size() && id < NODE_ARENA_DENSE * (long long)this->nodes.size() + NODE_ARENA_SLAB)
+            this->dense.resize(std::max<size_t>(id + 1, 2 * this->dense.size()), NULL);
+        if (0 <= id && id < this->dense.size())
+            this->dense[id] = node;
+        else
+            this->sparse.insert({ id, node });
+    }
+    /// Take an ID away from a node, if it holds it
+    void unmap(T* node, long long id)
+    {
+        if (0 <= id && id < this->dense.size() && this->dense[id] == node)
+            this->dense[id] = NULL;
+        auto it = this->sparse.find(id);
+        if (it != this->sparse.end() && it->second == node)
+            this->sparse.erase(it);
+    }
+};
+
+// A node_arena holds the individuals and couples of one pedigree, and
+// the packed child arrays of its couples. Nodes are constructed in the
+// active arena, which a pedigree claims when it is built or filled;
+// deleting the arena destroys all of its nodes at once.
+class node_arena
+{
+private:
+    node_pool<individual_node> indivs;
+    node_pool<coupled_node> couples;
+    /// Packed child arrays
+    std::vector<individual_node**> child_arrays;
+public:
+    // No copying
+    node_arena(const node_arena& other);
+    node_arena& operator=(const node_arena&);
+    // The arena in which nodes are constructed
+    static node_arena* active;
+    // Constructor
+    node_arena() {}
+    // Destructor -- destroys every node in the arena
+    ~node_arena();
+    // Make this the active arena (returns self)
+    node_arena* activate() { return node_arena::active = this; }
+    // The pool for each type of node
+    node_pool<individual_node>& pool(individual_node*) { return this->indivs; }
+    node_pool<coupled_node>& pool(coupled_node*) { return this->couples; }
+    // An array for n children, freed with the arena
+    individual_node** child_array(size_t n)
+    {
+        this->child_arrays.push_back(new individual_node*[n]);
+        return this->child_arrays.back();
+    }
+};
+
+#endif
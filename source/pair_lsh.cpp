@@ -0,0 +1,75 @@
+/********************************************************************
+* Implements the locality-sensitive prefilter for sibling candidate
+* pairs
+********************************************************************/
+
+#include "pair_lsh.h"
+
+#include <algorithm>
+#include <cstdint>
+
+// Mix a 64-bit value (splitmix64 finalizer)
+static uint64_t mix64(uint64_t x)
+{
+    x ^= x >> 30, x *= 0xBF58476D1CE4E5B9ull;
+    x ^= x >> 27, x *= 0x94D049BB133111EBull;
+    return x ^ x >> 31;
+}
+
+// Find the pairs of couples that collide in at least one band
+std::vector<std::pair<int, int>> lsh_candidate_pairs(const std::vector<coupled_node*>& grade, int num_blocks,
+    int bands, int rows, thread_pool* pool)
+{
+    int n = grade.size(), k = bands * rows;
+    /// One-permutation MinHash signature of every couple
+    std::vector<uint64_t> sig((size_t)n * k, UINT64_MAX);
+    pool->run((n + LSH_CHUNK - 1) / LSH_CHUNK, [&](int task, int thread) {
+        for (int i = task * LSH_CHUNK; i < std::min(n, (task + 1) * LSH_CHUNK); i++) {
+            uint64_t* s = &sig[(size_t)i * k];
+            for (int b = 0; b < num_blocks; b++) {
+                uint64_t hb = mix64(b + 1);
+                for (int m = 0; m < 2; m++) {
+                    gene g = (*(*grade[i])[m])[b];
+                    if (!g || (m && g == (*(*grade[i])[0])[b]))
+                        continue;
+                    uint64_t h = mix64(hb ^ g);
+                    uint64_t& bin = s[(h >> 32) * k >> 32];
+                    bin = std::min(bin, h);
+                }
+            }
+            /// Densify: an empty bin takes the value of the next full one,
+            /// rehashed with the distance, so that similar sets still agree
+            /// on it; couples with no known gene are left out
+            std::vector<uint64_t> full(s, s + k);
+            for (int j = 0; j < k; j++)
+                for (int t = 1; full[j] == UINT64_MAX && t < k; t++)
+                    if (full[(j + t) % k] != UINT64_MAX)
+                        s[j] = mix64(full[(j + t) % k] + t), t = k;
+        }
+    });
+    /// Bucket the couples band by band, pairing those sharing a bucket
+    std::vector<std::pair<int, int>> pairs;
+    std::vector<std::pair<uint64_t, int>> keys(n);
+    for (int band = 0; band < bands; band++) {
+        int m = 0;
+        for (int i = 0; i < n; i++) {
+            if (sig[(size_t)i * k] == UINT64_MAX)
+                continue;
+            uint64_t key = band;
+            for (int r = 0; r < rows; r++)
+                key = mix64(key ^ sig[(size_t)i * k + band * rows + r]);
+            keys[m++] = { key, i };
+        }
+        std::sort(keys.begin(), keys.begin() + m);
+        for (int lo = 0, hi; lo < m; lo = hi) {
+            for (hi = lo + 1; hi < m && keys[hi].first == keys[lo].first; hi++);
+            for (int a = lo; a < hi; a++)
+                for (int c = a + 1; c < hi; c++)
+                    pairs.push_back({ std::min(keys[a].second, keys[c].second), std::max(keys[a].second, keys[c].second) });
+        }
+        /// Drop repeats as they come, so that bands do not pile them up
+        std::sort(pairs.begin(), pairs.end());
+        pairs.erase(std::unique(pairs.begin(), pairs.end()), pairs.end());
+    }
+    return pairs;
+}
@@ -0,0 +1,28 @@
+/********************************************************************
+* Defines the locality-sensitive prefilter for sibling candidate
+* pairs: MinHash signatures of the (block, gene) sets of couples,
+* banded into hash buckets
+********************************************************************/
+
+#ifndef PAIR_LSH_H
+#define PAIR_LSH_H
+
+#include "poisson_pedigree.h"
+#include "thread_pool.h"
+
+#include <utility>
+#include <vector>
+
+// Couples per task when computing signatures
+#define LSH_CHUNK 64
+
+// Find the pairs of couples of a grade that collide in at least one of
+// bands buckets, each keyed by rows MinHash values of the couples' sets
+// of (block, non-zero gene). The signature is a one-permutation MinHash:
+// every element is hashed once into one of bands * rows bins, and empty
+// bins borrow from the next non-empty one.
+/// Returns pairs (i, j), i < j, of indices into grade, sorted
+std::vector<std::pair<int, int>> lsh_candidate_pairs(const std::vector<coupled_node*>& grade, int num_blocks,
+    int bands, int rows, thread_pool* pool);
+
+#endif
@@ -0,0 +1,440 @@
+/********************************************************************
+* Implements the binary pedigree format, and the reader for the
+* pedigree input of the programs
+********************************************************************/
+
+#include "pedigree_binary.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstring>
+#include <cctype>
+#include <cstdlib>
+#include <iostream>
+
+/************************ RECORD LAYOUT ****************************/
+
+// Round up to the section alignment
+static size_t ped_align(size_t x)
+{ return (x + PED_BINARY_ALIGN - 1) / PED_BINARY_ALIGN * PED_BINARY_ALIGN; }
+
+// Offsets of the sections of a record
+struct ped_binary_sections
+{
+    size_t indiv_id, indiv_couple, indiv_parent, couple_id, couple_member, child_start, child, grade_indiv, grade_couple;
+    std::vector<size_t> genomes;
+    size_t size;
+    /// Given the header and the grade sizes (in individuals)
+    ped_binary_sections(const ped_binary_header& h, const int64_t* grade_indiv)
+    {
+        size_t at = ped_align(sizeof(ped_binary_header));
+        auto take = [&](size_t bytes) { size_t off = at; at = ped_align(at + bytes); return off; };
+        this->indiv_id = take(8 * h.num_indiv);
+        this->indiv_couple = take(4 * h.num_indiv);
+        this->indiv_parent = take(4 * h.num_indiv);
+        this->couple_id = take(8 * h.num_couple);
+        this->couple_member = take(8 * h.num_couple);
+        this->child_start = take(8 * (h.num_couple + 1));
+        this->child = take(4 * h.num_child);
+        this->grade_indiv = take(8 * (h.num_gen + 1));
+        this->grade_couple = take(8 * (h.num_gen + 1));
+        for (int g = 0; grade_indiv && g < h.num_gen; g++)
+            this->genomes.push_back(take((size_t)h.gene_width * h.genome_len * (grade_indiv[g + 1] - grade_indiv[g])));
+        this->size = at;
+    }
+};
+
+// Check a record of len bytes against the file layout: every count,
+// offset and node index must fall inside the record (returns what is
+// wrong, or NULL if nothing is)
+static const char* ped_binary_error(const char* record, size_t len)
+{
+    const ped_binary_header& h = *reinterpret_cast<const ped_binary_header*>(record);
+    if (h.version != PED_BINARY_VERSION)
+        return "unsupported version";
+    if (h.size < (int64_t)sizeof(ped_binary_header) || h.size % PED_BINARY_ALIGN || (uint64_t)h.size > len)
+        return "record size does not match the input";
+    if (h.gene_width != 1 && h.gene_width != 2 && h.gene_width != 4 && h.gene_width != 8)
+        return "bad gene width";
+    /// Every section holds at least 4 bytes per entry, so counts past the
+    /// record size cannot be right (and cannot overflow the offsets)
+    int64_t most = h.size / 4;
+    if (h.num_gen < 1 || h.num_gen > most || h.genome_len < 0 || h.genome_len > INT32_MAX)
+        return "bad grade count or genome length";
+    if (h.num_indiv < 0 || h.num_indiv > std::min(most, (int64_t)INT32_MAX) ||
+        h.num_couple < 0 || h.num_couple > std::min(most, (int64_t)INT32_MAX) ||
+        h.num_child < 0 || h.num_child > most)
+        return "bad node count";
+    ped_binary_sections sec(h, NULL);
+    if (sec.size > (size_t)h.size)
+        return "node tables overrun the record";
+    /// Grades partition the individuals and a prefix of the couples
+    const int64_t* grade_indiv = reinterpret_cast<const int64_t*>(record + sec.grade_indiv);
+    const int64_t* grade_couple = reinterpret_cast<const int64_t*>(record + sec.grade_couple);
+    if (grade_indiv[0] || grade_couple[0] || grade_indiv[h.num_gen] != h.num_indiv || grade_couple[h.num_gen] > h.num_couple)
+        return "bad grade bounds";
+    size_t row = (size_t)h.gene_width * h.genome_len;
+    for (int64_t g = 0; g < h.num_gen; g++)
+        if (grade_indiv[g + 1] < grade_indiv[g] || grade_couple[g + 1] < grade_couple[g] ||
+            (row && (uint64_t)(grade_indiv[g + 1] - grade_indiv[g]) > (uint64_t)h.size / row))
+            return "bad grade bounds";
+    sec = ped_binary_sections(h, grade_indiv);
+    if (sec.size > (size_t)h.size)
+        return "genome matrices overrun the record";
+    /// Node indices point at nodes of the record
+    const int32_t* indiv_couple = reinterpret_cast<const int32_t*>(record + sec.indiv_couple);
+    const int32_t* indiv_parent = reinterpret_cast<const int32_t*>(record + sec.indiv_parent);
+    const int32_t* couple_member = reinterpret_cast<const int32_t*>(record + sec.couple_member);
+    const int64_t* child_start = reinterpret_cast<const int64_t*>(record + sec.child_start);
+    const int32_t* child = reinterpret_cast<const int32_t*>(record + sec.child);
+    for (int64_t i = 0; i < h.num_indiv; i++)
+        if (indiv_couple[i] < -1 || indiv_couple[i] >= h.num_couple || indiv_parent[i] < -1 || indiv_parent[i] >= h.num_couple)
+            return "bad couple index";
+    for (int64_t c = 0; c < 2 * h.num_couple; c++)
+        if (couple_member[c] < -1 || couple_member[c] >= h.num_indiv)
+            return "bad individual index";
+    if (child_start[0] || child_start[h.num_couple] != h.num_child)
+        return "bad child bounds";
+    for (int64_t c = 0; c < h.num_couple; c++)
+        if (child_start[c + 1] < child_start[c])
+            return "bad child bounds";
+    for (int64_t k = 0; k < h.num_child; k++)
+        if (child[k] < 0 || child[k] >= h.num_indiv)
+            return "bad child index";
+    return NULL;
+}
+
+/************************ DUMP AND RESTORE *************************/
+
+// Dump the pedigree as a binary record
+std::string poisson_pedigree::dump_binary()
+{
+    /// Number couples grade by grade in ID order, each followed by its
+    /// members; children of the grade above that are in no couple of the
+    /// pedigree come after them, then their mates that are not otherwise
+    /// in the pedigree, and their own couples after all grades
+    std::vector<coupled_node*> couples;
+    std::vector<individual_node*> indivs;
+    std::vector<int64_t> grade_indiv(1, 0), grade_couple(1, 0);
+    std::unordered_map<coupled_node*, int> couple_index;
+    std::unordered_map<individual_node*, int> indiv_index;
+    std::vector<std::vector<coupled_node*>> grade(this->num_gen);
+    for (int g = 0; g < this->num_gen; g++) {
+        grade[g].assign(this->grades[g].begin(), this->grades[g].end());
+        std::sort(grade[g].begin(), grade[g].end(), id_less());
+        for (coupled_node* couple : grade[g])
+            indiv_index[(*couple)[0]] = indiv_index[(*couple)[1]] = -1;
+    }
+    auto add_indiv = [&](individual_node* indiv) {
+        indiv_index[indiv] = indivs.size();
+        indivs.push_back(indiv);
+    };
+    for (int g = 0; g < this->num_gen; g++) {
+        for (coupled_node* couple : grade[g]) {
+            couple_index[couple] = couples.size();
+            couples.push_back(couple);
+            add_indiv((*couple)[0]);
+            if ((*couple)[1] != (*couple)[0])
+                add_indiv((*couple)[1]);
+        }
+        std::vector<individual_node*> single;
+        for (int c = 0; g + 1 < this->num_gen && c < grade[g + 1].size(); c++)
+            for (individual_node* indiv : *grade[g + 1][c])
+                if (indiv_index.find(indiv) == indiv_index.end())
+                    single.push_back(indiv);
+        std::sort(single.begin(), single.end(), id_less());
+        for (individual_node* indiv : single)
+            if (indiv_index.find(indiv) == indiv_index.end())
+                add_indiv(indiv);
+        /// Their mates, if not otherwise in the pedigree, join them
+        std::vector<individual_node*> mate;
+        for (individual_node* indiv : single)
+            for (int i = 0; indiv->couple() && i < 2; i++)
+                if ((*indiv->couple())[i] && indiv_index.find((*indiv->couple())[i]) == indiv_index.end()) {
+                    indiv_index[(*indiv->couple())[i]] = -1;
+                    mate.push_back((*indiv->couple())[i]);
+                }
+        std::sort(mate.begin(), mate.end(), id_less());
+        for (individual_node* indiv : mate)
+            add_indiv(indiv);
+        grade_indiv.push_back(indivs.size());
+        grade_couple.push_back(couples.size());
+    }
+    std::vector<coupled_node*> extra;
+    for (individual_node* indiv : indivs)
+        if (indiv->couple() && couple_index.find(indiv->couple()) == couple_index.end()) {
+            couple_index[indiv->couple()] = -1;
+            extra.push_back(indiv->couple());
+        }
+    std::sort(extra.begin(), extra.end(), id_less());
+    for (coupled_node* couple : extra) {
+        couple_index[couple] = couples.size();
+        couples.push_back(couple);
+    }
+    auto index_of = [](auto& index, auto* node) {
+        auto it = index.find(node);
+        return it == index.end() ? -1 : it->second;
+    };
+    gene max_gene = 0;
+    for (individual_node* indiv : indivs)
+        for (int b = 0; b < this->genome_len; b++)
+            max_gene = std::max(max_gene, (gene)(*indiv)[b]);
+    /// Children of each couple, in the order the couple holds them
+    std::vector<std::vector<int32_t>> children(couples.size());
+    int64_t num_child = 0;
+    for (int c = 0; c < couples.size(); c++) {
+        for (individual_node* indiv : *couples[c])
+            if (index_of(indiv_index, indiv) >= 0)
+                children[c].push_back(indiv_index[indiv]);
+        num_child += children[c].size();
+    }
+    /// Fill in the header and lay out the record
+    ped_binary_header h;
+    std::memset(&h, 0, sizeof(h));
+    std::memcpy(h.magic, PED_BINARY_MAGIC, sizeof(h.magic));
+    h.version = PED_BINARY_VERSION;
+    h.gene_width = genome_store::width_for(max_gene);
+    h.genome_len = this->genome_len, h.tfr = this->tfr, h.num_gen = this->num_gen;
+    h.pop_sz = this->pop_sz, h.deterministic = this->deterministic;
+    h.num_indiv = indivs.size(), h.num_couple = couples.size(), h.num_child = num_child;
+    h.max_gene = max_gene;
+    ped_binary_sections sec(h, grade_indiv.data());
+    h.size = sec.size;
+    std::string d(sec.size, '\0');
+    char* rec = &d[0];
+    std::memcpy(rec, &h, sizeof(h));
+    /// Node tables
+    int64_t* indiv_id = reinterpret_cast<int64_t*>(rec + sec.indiv_id);
+    int32_t* indiv_couple = reinterpret_cast<int32_t*>(rec + sec.indiv_couple);
+    int32_t* indiv_parent = reinterpret_cast<int32_t*>(rec + sec.indiv_parent);
+    for (int i = 0; i < indivs.size(); i++) {
+        indiv_id[i] = indivs[i]->get_id();
+        indiv_couple[i] = index_of(couple_index, indivs[i]->couple());
+        indiv_parent[i] = index_of(couple_index, indivs[i]->parent());
+    }
+    int64_t* couple_id = reinterpret_cast<int64_t*>(rec + sec.couple_id);
+    int32_t* couple_member = reinterpret_cast<int32_t*>(rec + sec.couple_member);
+    int64_t* child_start = reinterpret_cast<int64_t*>(rec + sec.child_start);
+    int32_t* child = reinterpret_cast<int32_t*>(rec + sec.child);
+    for (int c = 0; c < couples.size(); c++) {
+        couple_id[c] = couples[c]->get_id();
+        couple_member[2 * c] = index_of(indiv_index, (*couples[c])[0]);
+        couple_member[2 * c + 1] = index_of(indiv_index, (*couples[c])[1]);
+        child_start[c + 1] = child_start[c] + children[c].size();
+        std::copy(children[c].begin(), children[c].end(), child + child_start[c]);
+    }
+    std::copy(grade_indiv.begin(), grade_indiv.end(), reinterpret_cast<int64_t*>(rec + sec.grade_indiv));
+    std::copy(grade_couple.begin(), grade_couple.end(), reinterpret_cast<int64_t*>(rec + sec.grade_couple));
+    /// Genome matrices, copying whole rows when the store layout matches
+    for (int g = 0; g < this->num_gen; g++) {
+        for (int i = grade_indiv[g]; i < grade_indiv[g + 1]; i++) {
+            char* out = rec + sec.genomes[g] + (size_t)(i - grade_indiv[g]) * h.gene_width * h.genome_len;
+            genome_store* store = indivs[i]->get_genome();
+            if (store->get_layout() == GENOME_INDIV_MAJOR && store->bytes_per_gene() == h.gene_width)
+                std::memcpy(out, store->row(indivs[i]->get_slot()), (size_t)h.gene_width * h.genome_len);
+            else {
+                genome_store wrap(this->genome_len, h.gene_width, 1, out);
+                for (int b = 0, end; b < this->genome_len; b = end)
+                    for (gene g = indivs[i]->run(b, end); b < end; b++)
+                        wrap.set(0, b, g);
+            }
+        }
+    }
+    return d;
+}
+
+// Rebuild a pedigree from a binary record (checked by ped_binary_error)
+poisson_pedigree* poisson_pedigree::recover_binary(char* record, bool extant, poisson_pedigree* ped)
+{
+    const ped_binary_header& h = *reinterpret_cast<ped_binary_header*>(record);
+    /// Find the sections
+    ped_binary_sections sec(h, NULL);
+    const int64_t* grade_indiv = reinterpret_cast<int64_t*>(record + sec.grade_indiv);
+    const int64_t* grade_couple = reinterpret_cast<int64_t*>(record + sec.grade_couple);
+    sec = ped_binary_sections(h, grade_indiv);
+    const int64_t* indiv_id = reinterpret_cast<int64_t*>(record + sec.indiv_id);
+    const int32_t* indiv_couple = reinterpret_cast<int32_t*>(record + sec.indiv_couple);
+    const int32_t* indiv_parent = reinterpret_cast<int32_t*>(record + sec.indiv_parent);
+    const int64_t* couple_id = reinterpret_cast<int64_t*>(record + sec.couple_id);
+    const int32_t* couple_member = reinterpret_cast<int32_t*>(record + sec.couple_member);
+    const int64_t* child_start = reinterpret_cast<int64_t*>(record + sec.child_start);
+    const int32_t* child = reinterpret_cast<int32_t*>(record + sec.child);
+    /// Reset the pedigree, whose arena receives the nodes
+    ped->arena->activate();
+    for (genome_store* store : ped->genomes)
+        delete store;
+    delete[] ped->grades;
+    ped->init(h.genome_len, h.tfr, h.num_gen, h.pop_sz, h.deterministic, NULL);
+    ped->max_gene = std::max((gene)h.max_gene, ped->max_gene);
+    ped->genomes.resize(h.num_gen, NULL);
+    /// Individuals keep their genomes where they are in the record
+    int num_grade = extant ? 1 : h.num_gen;
+    std::vector<individual_node*> indivs;
+    for (int g = 0; g < num_grade; g++) {
+        ped->genomes[g] = new genome_store(h.genome_len, h.gene_width, grade_indiv[g + 1] - grade_indiv[g], record + sec.genomes[g]);
+        for (int i = grade_indiv[g]; i < grade_indiv[g + 1]; i++)
+            indivs.push_back(new individual_node(ped->genomes[g], i - grade_indiv[g], indiv_id[i]));
+    }
+    ped->reset();
+    /// An extant population is just the self-coupled individuals
+    if (extant) {
+        for (individual_node* indiv : indivs)
+            ped->add_to_current(indiv->mate_with(indiv));
+        return ped;
+    }
+    /// Otherwise rebuild all couples, then place those in grades
+    std::vector<coupled_node*> couples;
+    for (int c = 0; c < h.num_couple; c++) {
+        coupled_node* couple = new coupled_node(couple_id[c]);
+        (*couple)[0] = couple_member[2 * c] < 0 ? NULL : indivs[couple_member[2 * c]];
+        (*couple)[1] = couple_member[2 * c + 1] < 0 ? NULL : indivs[couple_member[2 * c + 1]];
+        couples.push_back(couple);
+    }
+    for (int c = 0; c < h.num_couple; c++)
+        for (int64_t k = child_start[c]; k < child_start[c + 1]; k++)
+            couples[c]->add_child(indivs[child[k]]);
+    for (int i = 0; i < h.num_indiv; i++) {
+        indivs[i]->assign_couple(indiv_couple[i] < 0 ? NULL : couples[indiv_couple[i]]);
+        indivs[i]->assign_par(indiv_parent[i] < 0 ? NULL : couples[indiv_parent[i]]);
+    }
+    for (int g = 0; g < h.num_gen; g++)
+        for (int c = grade_couple[g]; c < grade_couple[g + 1]; c++)
+            ped->grades[g].insert(couples[c]);
+    ped->cur_gen = h.num_gen - 1;
+    return ped->pack_children();
+}
+
+/************************** INPUT READER ***************************/
+
+// Construct given a file descriptor (0 for standard input)
+pedigree_input::pedigree_input(int fd)
+{
+    this->fd = fd;
+    this->data = NULL;
+    this->len = this->cap = this->pos = 0;
+    this->mapped = this->eof = false;
+    /// Map regular files privately, so that genomes can still be modified
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void* p = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED) {
+            this->data = static_cast<char*>(p);
+            this->len = this->cap = st.st_size;
+            this->mapped = this->eof = true;
+            return;
+        }
+    }
+    /// Otherwise stream the input in chunks
+    this->cap = PED_INPUT_CHUNK;
+    this->data = new char[this->cap];
+}
+
+// Destructor -- unmaps or frees the input
+pedigree_input::~pedigree_input()
+{
+    if (this->mapped)
+        munmap(this->data, this->len);
+    else
+        delete[] this->data;
+    for (char* copy : this->copies)
+        delete[] copy;
+}
+
+// Make at least need bytes past the read position available
+bool pedigree_input::fill(size_t need)
+{
+    while (this->len - this->pos < need && !this->eof) {
+        /// Drop what has been read, and grow if the request still does not fit
+        std::memmove(this->data, this->data + this->pos, this->len - this->pos);
+        this->len -= this->pos;
+        this->pos = 0;
+        if (need > this->cap) {
+            this->cap = std::max(need, 2 * this->cap);
+            char* grown = new char[this->cap];
+            std::memcpy(grown, this->data, this->len);
+            delete[] this->data;
+            this->data = grown;
+        }
+        ssize_t got = read(this->fd, this->data + this->len, this->cap - this->len);
+        if (got <= 0)
+            this->eof = true;
+        else
+            this->len += got;
+    }
+    return this->len - this->pos >= need;
+}
+
+// Skip whitespace (returns whether input remains)
+bool pedigree_input::skip_space()
+{
+    while (this->fill(1) && std::isspace((unsigned char)this->data[this->pos]))
+        this->pos++;
+    return this->fill(1);
+}
+
+// End of the current line
+size_t pedigree_input::line_end()
+{
+    /// Only the bytes that arrived since the last look need scanning
+    for (size_t scanned = 0;;) {
+        char* b = this->data + this->pos;
+        char* nl = static_cast<char*>(std::memchr(b + scanned, '\n', this->len - this->pos - scanned));
+        char* stop = static_cast<char*>(std::memchr(b + scanned, STOP_CHAR, (nl ? nl : this->data + this->len) - b - scanned));
+        if (stop || nl)
+            return (stop ? stop : nl) - this->data;
+        scanned = this->len - this->pos;
+        if (!this->fill(scanned + 1))
+            return this->len;
+    }
+}
+
+// Report a bad binary record and exit
+void pedigree_input::fail(const char* error)
+{
+    std::cerr << "Invalid binary pedigree: " << error << std::endl;
+    std::exit(1);
+}
+
+// Whether all pedigrees have been read
+bool pedigree_input::done() { return !this->skip_space(); }
+
+// Whether the next pedigree is a binary record
+bool pedigree_input::next_binary()
+{
+    return this->skip_space() && this->fill(sizeof(ped_binary_header)) &&
+        std::memcmp(this->data + this->pos, PED_BINARY_MAGIC, 8) == 0;
+}
+
+// Read the next pedigree
+poisson_pedigree* pedigree_input::next(bool extant)
+{
+    /// Binary records are used in place if mapped and aligned, and copied
+    /// otherwise; they are checked first, and a bad record ends the program
+    if (this->next_binary()) {
+        int64_t size = reinterpret_cast<ped_binary_header*>(this->data + this->pos)->size;
+        if (size < (int64_t)sizeof(ped_binary_header) || !this->fill(size))
+            pedigree_input::fail("record size does not match the input");
+        char* record = this->data + this->pos;
+        if (!this->mapped || reinterpret_cast<uintptr_t>(record) % alignof(int64_t)) {
+            this->copies.push_back(new char[size]);
+            record = static_cast<char*>(std::memcpy(this->copies.back(), record, size));
+        }
+        if (const char* error = ped_binary_error(record, size))
+            pedigree_input::fail(error);
+        this->pos += size;
+        return poisson_pedigree::recover_binary(record, extant, new poisson_pedigree());
+    }
+    /// Text dumps are parsed a line at a time up to the next STOP_CHAR
+    dump_parser parser(new poisson_pedigree());
+    while (this->fill(1)) {
+        size_t end = this->line_end();
+        bool stop = end < this->len && this->data[end] == STOP_CHAR;
+        parser.read_line(this->data + this->pos, this->data + end);
+        this->pos = std::min(this->len, end + 1);
+        if (stop)
+            break;
+    }
+    return parser.finish();
+}
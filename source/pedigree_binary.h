@@ -0,0 +1,104 @@
+/********************************************************************
+* Defines the binary pedigree format, and a reader for the pedigree
+* input of the programs, which may hold text dumps separated by
+* STOP_CHAR, binary records, or a mix of both
+********************************************************************/
+
+#ifndef PEDIGREE_BINARY_H
+#define PEDIGREE_BINARY_H
+
+#include "poisson_pedigree.h"
+#include "pedigree_text.h"
+
+#include <cstdint>
+#include <vector>
+
+// Text dumps in a stream are separated by STOP_CHAR
+#define STOP_CHAR '~'
+
+// Binary records start with an 8-byte magic string and a version
+#define PED_BINARY_MAGIC "RGPEDBIN"
+#define PED_BINARY_VERSION 1
+// Sections start at multiples of this many bytes from the record start
+#define PED_BINARY_ALIGN 64
+// Streamed input is read in chunks of this many bytes
+#define PED_INPUT_CHUNK (1 << 20)
+
+// A binary record is the header below, followed by these sections
+// (integers in host byte order):
+//   int64 indiv_id[num_indiv]            individuals, grouped by grade
+//   int32 indiv_couple[num_indiv]        index of the mate couple
+//   int32 indiv_parent[num_indiv]        index of the parent couple
+//   int64 couple_id[num_couple]          couples, grouped by grade
+//   int32 couple_member[2 * num_couple]  indices of the two members
+//   int64 child_start[num_couple + 1]    children of couple c are
+//                                        child[child_start[c], child_start[c + 1])
+//   int32 child[num_child]               individual indices
+//   int64 grade_indiv[num_gen + 1]       individuals of grade g are
+//                                        [grade_indiv[g], grade_indiv[g + 1])
+//   int64 grade_couple[num_gen + 1]      same for couples; couples past
+//                                        grade_couple[num_gen] are in no grade
+//   one genome matrix per grade          a row of genome_len genes,
+//                                        gene_width bytes each, per individual
+// Missing nodes are written as index -1. An individual belongs to the
+// grade of its mate couple, or to the grade below its parents if its mate
+// couple is in no grade (its mate then joins it there if in no other
+// grade). The record size is a multiple of
+// PED_BINARY_ALIGN, so records can be concatenated.
+struct ped_binary_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t gene_width;
+    int64_t genome_len, tfr, num_gen, pop_sz, deterministic;
+    int64_t num_indiv, num_couple, num_child;
+    int64_t max_gene;
+    int64_t size; /// Total bytes in the record
+};
+
+// Reads the pedigrees given to a program on a file descriptor. Regular
+// files are memory-mapped, so the genome matrices of binary records are
+// used in place; other inputs (pipes) are streamed through a buffer of
+// a few chunks, with text dumps parsed line by line as they arrive. The
+// reader must outlive the pedigrees it returns.
+class pedigree_input
+{
+private:
+    /// Input window (the whole input if mapped), its valid length,
+    /// capacity, and the read position within it
+    char* data;
+    size_t len, cap, pos;
+    int fd;
+    bool mapped, eof;
+    /// Copies of binary records that could not be used in place
+    std::vector<char*> copies;
+    /// Make at least need bytes past the read position available,
+    /// reading more of a streamed input (returns whether they are)
+    bool fill(size_t need);
+    /// Skip whitespace (returns whether input remains)
+    bool skip_space();
+    /// End of the current line: the next newline or STOP_CHAR, or the
+    /// end of the input
+    size_t line_end();
+    /// Report a bad binary record and exit
+    [[noreturn]] static void fail(const char* error);
+public:
+    // No copying
+    NOT_COPYABLE(pedigree_input)
+    // Constructor
+    /// Given a file descriptor (0 for standard input)
+    pedigree_input(int fd);
+    // Destructor -- unmaps or frees the input
+    ~pedigree_input();
+    // Whether all pedigrees have been read
+    bool done();
+    // Whether the next pedigree is a binary record
+    bool next_binary();
+    // Read the next pedigree; for binary records, extant selects only the
+    // extant population (text dumps already hold one or the other). A
+    // binary record that is truncated or inconsistent ends the program
+    // with a message
+    poisson_pedigree* next(bool extant);
+};
+
+#endif
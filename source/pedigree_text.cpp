@@ -0,0 +1,361 @@
+/********************************************************************
+* Implements a streaming parser for the text dump format, which
+* builds pedigree nodes directly as lines of a dump arrive
+********************************************************************/
+
+#include "pedigree_text.h"
+
+#include <charconv>
+#include <cstring>
+#include <utility>
+
+/************************** TOKENIZING *****************************/
+
+// Walks the whitespace-separated tokens of a line
+struct token_cursor
+{
+    const char* p;
+    const char* e;
+    /// Find the next token (returns whether there is one)
+    bool next(const char*& tb, const char*& te)
+    {
+        while (this->p < this->e && (*this->p == ' ' || *this->p == '\t' || *this->p == '\r'))
+            this->p++;
+        if (this->p == this->e)
+            return false;
+        tb = this->p;
+        while (this->p < this->e && *this->p != ' ' && *this->p != '\t' && *this->p != '\r')
+            this->p++;
+        te = this->p;
+        return true;
+    }
+    /// Read the next token as a number (returns whether it is one)
+    template <typename T>
+    bool number(T& out)
+    {
+        const char *tb, *te;
+        if (!this->next(tb, te))
+            return false;
+        auto r = std::from_chars(tb, te, out);
+        return r.ec == std::errc() && r.ptr == te;
+    }
+};
+
+// Short name of a flag token (-x or --name), or 0 if it is not one of
+// the flags given
+static char flag_name(const char* tb, const char* te, std::initializer_list<std::pair<char, const char*>> flags)
+{
+    size_t n = te - tb;
+    for (auto& f : flags)
+        if ((n == 2 && tb[0] == '-' && tb[1] == f.first) ||
+            (n > 2 && tb[0] == '-' && tb[1] == '-' && n - 2 == std::strlen(f.second) && !std::memcmp(tb + 2, f.second, n - 2)))
+            return f.first;
+    return 0;
+}
+
+/*************************** FAST PATHS ****************************/
+
+// Pedigree lines: -B {blocks} -A {alpha} -T {generations} -N {founders}
+// -n {extant} -d, and -i {id} / -c {id} declaring nodes ahead of use
+bool dump_parser::read_pedigree(const char* b, const char* e)
+{
+    /// Read every flag before applying any, so that failing changes nothing
+    token_cursor t = { b, e };
+    const char *tb, *te;
+    std::vector<std::pair<char, long long>> flags;
+    while (t.next(tb, te)) {
+        char f = flag_name(tb, te, { { 'B', "blocks" }, { 'A', "alpha" }, { 'T', "generations" }, { 'N', "founders" },
+            { 'n', "extant" }, { 'd', "deterministic" }, { 'i', "individual" }, { 'c', "couple" } });
+        long long v = 0;
+        if (!f || (f != 'd' && !t.number(v)))
+            return false;
+        flags.push_back({ f, v });
+    }
+    for (auto& f : flags)
+        switch (f.first) {
+            case 'B': this->ped->genome_len = f.second; break;
+            case 'A': this->ped->tfr = f.second; break;
+            case 'N': this->ped->pop_sz = f.second; break;
+            case 'n': this->extant_size = f.second; break;
+            case 'd': this->ped->deterministic = true; break;
+            case 'T':
+                this->ped->num_gen = f.second;
+                delete[] this->ped->grades;
+                this->ped->grades = new std::unordered_set<coupled_node*>[this->ped->num_gen];
+                for (genome_store* store : this->ped->genomes)
+                    delete store;
+                this->ped->genomes.clear();
+                break;
+            case 'i':
+                if (!individual_node::get_member_by_id(f.second))
+                    new individual_node(1, f.second);
+                break;
+            case 'c':
+                if (!coupled_node::get_member_by_id(f.second))
+                    new coupled_node(f.second);
+                break;
+        }
+    return true;
+}
+
+// Individual lines: i -i {id} -c {couple id} -p {parent id} -g {n} {genes}
+bool dump_parser::read_individual(const char* b, const char* e)
+{
+    token_cursor t = { b + 1, e };
+    const char *tb, *te;
+    long long id = -1, mate = -1, par = -1;
+    int genome_size = -1;
+    while (t.next(tb, te)) {
+        char f = flag_name(tb, te, { { 'i', "id" }, { 'c', "couple" }, { 'p', "parent" }, { 'g', "genome" } });
+        /// The id has to come first, since it decides which node the rest applies to
+        if (!f || (f == 'i') != (id < 0))
+            return false;
+        if (f == 'g') {
+            if (!t.number(genome_size) || genome_size < 0)
+                return false;
+            this->genes.resize(genome_size);
+            for (int i = 0; i < genome_size; i++)
+                if (!t.number(this->genes[i]))
+                    return false;
+        }
+        else if (!t.number(f == 'i' ? id : f == 'c' ? mate : par))
+            return false;
+    }
+    if (id < 0)
+        return false;
+    individual_node* indiv = individual_node::get_member_by_id(id);
+    if (indiv == NULL)
+        indiv = new individual_node(0, id);
+    if (mate >= 0)
+        indiv->assign_couple(coupled_node::get_member_by_id(mate));
+    if (par >= 0)
+        indiv->assign_par(coupled_node::get_member_by_id(par));
+    if (genome_size >= 0)
+        indiv->set_genome(genome_size, this->genes.data());
+    this->add(indiv);
+    return true;
+}
+
+// Couple lines: c -i {id} -m 2 {member ids} -c {n} {children ids}
+bool dump_parser::read_couple(const char* b, const char* e)
+{
+    token_cursor t = { b + 1, e };
+    const char *tb, *te;
+    long long id = -1;
+    int num_member = -1, num_child = -1;
+    this->ids.clear();
+    while (t.next(tb, te)) {
+        char f = flag_name(tb, te, { { 'i', "id" }, { 'm', "members" }, { 'c', "children" } });
+        if (!f || (f == 'i') != (id < 0))
+            return false;
+        if (f == 'i') {
+            if (!t.number(id) || id < 0)
+                return false;
+            continue;
+        }
+        /// Members come before children in the id list
+        int n;
+        if (!t.number(n) || n < 0 || (f == 'm' ? (num_member >= 0 || num_child >= 0 || n < 2) : num_child >= 0))
+            return false;
+        (f == 'm' ? num_member : num_child) = n;
+        for (int i = 0; i < n; i++) {
+            this->ids.push_back(0);
+            if (!t.number(this->ids.back()))
+                return false;
+        }
+    }
+    if (id < 0)
+        return false;
+    coupled_node* couple = coupled_node::get_member_by_id(id);
+    if (couple == NULL)
+        couple = new coupled_node(id);
+    int at = 0;
+    if (num_member >= 0) {
+        (*couple)[0] = individual_node::get_member_by_id(this->ids[0]);
+        (*couple)[1] = individual_node::get_member_by_id(this->ids[1]);
+        at = num_member;
+    }
+    for (; at < this->ids.size(); at++)
+        if (individual_node* ch = individual_node::get_member_by_id(this->ids[at]))
+            couple->add_child(ch);
+    this->add(couple);
+    return true;
+}
+
+/**************************** PARSING ******************************/
+
+// Construct given the pedigree to fill, whose arena receives the nodes read
+dump_parser::dump_parser(poisson_pedigree* ped)
+{
+    this->ped = ped;
+    this->extant_size = -1;
+    ped->nodes()->activate();
+}
+
+// Record a node read from a line
+void dump_parser::add(individual_node* indiv)
+{
+    if (this->seen_indiv.insert(indiv).second)
+        this->indivs.push_back(indiv);
+}
+void dump_parser::add(coupled_node* couple)
+{
+    if (this->seen_couple.insert(couple).second)
+        this->coups.push_back(couple);
+}
+
+// Define the flags of the pedigree flag reader, which fills in the
+// dump_parser possessing it
+void dump_parser::init_flags()
+{
+    flag_reader& frin = poisson_pedigree::frin;
+    if (!frin.is_new())
+        return;
+    /// Read block size
+    frin.add_flag("blocks", 'B', 1, [](std::vector<std::string> v, void* p) {
+        static_cast<dump_parser*>(p)->ped->genome_len = std::stoi(v[0]);
+    });
+    /// Read alpha (TFR)
+    frin.add_flag("alpha", 'A', 1, [](std::vector<std::string> v, void* p) {
+        static_cast<dump_parser*>(p)->ped->tfr = std::stoi(v[0]);
+    });
+    /// Read number of generations
+    frin.add_flag("generations", 'T', 1, [](std::vector<std::string> v, void* p) {
+        poisson_pedigree* ped = static_cast<dump_parser*>(p)->ped;
+        ped->num_gen = std::stoi(v[0]);
+        delete[] ped->grades;
+        ped->grades = new std::unordered_set<coupled_node*>[ped->num_gen];
+        for (genome_store* store : ped->genomes)
+            delete store;
+        ped->genomes.clear();
+    });
+    /// Read founder size
+    frin.add_flag("founders", 'N', 1, [](std::vector<std::string> v, void* p) {
+        static_cast<dump_parser*>(p)->ped->pop_sz = std::stoi(v[0]);
+    });
+    /// Read extant size
+    frin.add_flag("extant", 'n', 1, [](std::vector<std::string> v, void* p) {
+        static_cast<dump_parser*>(p)->extant_size = std::stoi(v[0]);
+    });
+    /// Read deterministic flag
+    frin.add_flag("deterministic", 'd', 0, [](std::vector<std::string> v, void* p) {
+        static_cast<dump_parser*>(p)->ped->deterministic = true;
+    });
+    /// Make a new individual
+    frin.add_flag("individual", 'i', 1, [](std::vector<std::string> v, void* p) {
+        new individual_node(1, std::stoll(v[0]));
+    });
+    /// Make a new couple
+    frin.add_flag("couple", 'c', 1, [](std::vector<std::string> v, void* p) {
+        new coupled_node(std::stoll(v[0]));
+    });
+}
+
+// Parse one line
+void dump_parser::read_line(const char* b, const char* e)
+{
+    /// Ignore empty lines
+    if (b == e)
+        return;
+    /// Lines starting with '-' describe the pedigree
+    else if (*b == '-') {
+        if (!this->read_pedigree(b, e)) {
+            dump_parser::init_flags();
+            poisson_pedigree::frin.possess(this);
+            poisson_pedigree::frin.read_flags(std::string(b, e));
+        }
+    }
+    /// Lines starting with 'i' describe individuals
+    else if (*b == 'i') {
+        if (!this->read_individual(b, e))
+            this->add(individual_node::recover_dumped(std::string(b, e), new individual_node()));
+    }
+    /// Lines starting with 'c' describe couples
+    else if (*b == 'c') {
+        if (!this->read_couple(b, e))
+            this->add(coupled_node::recover_dumped(std::string(b, e), new coupled_node()));
+    }
+}
+
+// Place the nodes read into grades and return the pedigree
+poisson_pedigree* dump_parser::finish()
+{
+    poisson_pedigree* ped = this->ped;
+    // If the extant generation parameter is set, insert the couples to the bottom
+    if (this->extant_size >= 0) {
+        /// Reset pedigree
+        ped->reset();
+        for (individual_node* indiv : this->indivs)
+            ped->add_to_current(indiv->mate_with(indiv));
+    }
+    // Otherwise, find the extant population and rebuild the tree
+    else {
+        /// Set current generation to extant
+        ped->reset();
+        /// Extant is self-coupled
+        for (coupled_node* couple : this->coups)
+            if ((*couple)[0] == (*couple)[1])
+                ped->add_to_current(couple);
+        /// Add the ancestors
+        while (ped->cur_gen < ped->num_gen - 1) {
+            ped->new_grade();
+            for (coupled_node* couple : (*ped)[ped->cur_gen - 1])
+                for (int i = 0; i < 2; i++)
+                    if ((*couple)[i]->parent() && ped->grades[ped->cur_gen].find((*couple)[i]->parent()) == ped->end())
+                        ped->add_to_current((*couple)[i]->parent());
+        }
+    }
+    // Gather the individual genomes into per-grade stores
+    return ped->pack_genomes()->pack_children();
+}
+
+/**************************** WRITING ******************************/
+
+// Construct given a stream or a string to append to
+dump_writer::dump_writer(std::ostream& out)
+{
+    this->out = &out;
+    this->str = NULL;
+    this->buf = new char[DUMP_WRITER_CHUNK];
+    this->len = 0;
+}
+dump_writer::dump_writer(std::string& out)
+{
+    this->out = NULL;
+    this->str = &out;
+    this->buf = new char[DUMP_WRITER_CHUNK];
+    this->len = 0;
+}
+
+// Destructor -- flushes
+dump_writer::~dump_writer()
+{
+    this->flush();
+    delete[] this->buf;
+}
+
+// Hand the buffered text to the sink
+void dump_writer::flush()
+{
+    if (this->out)
+        this->out->write(this->buf, this->len);
+    else
+        this->str->append(this->buf, this->len);
+    this->len = 0;
+}
+
+// Write text; text longer than a chunk goes straight to the sink
+dump_writer& dump_writer::write(const char* s, size_t n)
+{
+    this->reserve(n);
+    if (n > DUMP_WRITER_CHUNK) {
+        if (this->out)
+            this->out->write(s, n);
+        else
+            this->str->append(s, n);
+        return *this;
+    }
+    std::memcpy(this->buf + this->len, s, n);
+    this->len += n;
+    return *this;
+}
@@ -0,0 +1,121 @@
+/********************************************************************
+* Defines a streaming parser for the text dump format, which builds
+* pedigree nodes directly as lines of a dump arrive, and a buffered
+* writer through which dumps are written
+********************************************************************/
+
+#ifndef PEDIGREE_TEXT_H
+#define PEDIGREE_TEXT_H
+
+#include "poisson_pedigree.h"
+
+#include <unordered_set>
+#include <type_traits>
+#include <charconv>
+#include <ostream>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// Dump writers collect output in chunks of this many bytes
+#define DUMP_WRITER_CHUNK (1 << 16)
+
+// A dump_parser rebuilds one pedigree from the lines of a text dump
+// (as written by poisson_pedigree::dump and dump_extant), one line at
+// a time. The usual forms of the pedigree, individual, and couple
+// lines are scanned in place without tokenizing into strings; any
+// other line is handed to the flag readers of the classes, so the
+// grammar is unchanged.
+class dump_parser
+{
+private:
+    // Pedigree being rebuilt
+    poisson_pedigree* ped;
+    int extant_size;
+    /// Nodes read so far, in the order their lines appeared
+    std::vector<individual_node*> indivs;
+    std::vector<coupled_node*> coups;
+    std::unordered_set<individual_node*> seen_indiv;
+    std::unordered_set<coupled_node*> seen_couple;
+    // Scratch space reused across lines
+    std::vector<gene> genes;
+    std::vector<long long> ids;
+    // Fast paths for each kind of line; they return false without
+    // changing anything if the line is not in the usual form
+    bool read_pedigree(const char* b, const char* e);
+    bool read_individual(const char* b, const char* e);
+    bool read_couple(const char* b, const char* e);
+    /// Record a node read from a line
+    void add(individual_node* indiv);
+    void add(coupled_node* couple);
+    /// Define the flags of the pedigree flag reader (the fallback)
+    static void init_flags();
+public:
+    // No copying
+    NOT_COPYABLE(dump_parser)
+    // Constructor
+    /// Given the pedigree to fill, whose arena receives the nodes read
+    dump_parser(poisson_pedigree* ped);
+    // Parse one line, given its first and one-past-last characters
+    void read_line(const char* b, const char* e);
+    // Place the nodes read into grades and return the pedigree
+    poisson_pedigree* finish();
+};
+
+// A dump_writer formats text into a fixed chunk buffer and hands the
+// buffer to its sink (a stream or a string) whenever it fills, so that
+// writing a dump costs time linear in its length and a bounded amount of
+// memory beyond the sink.
+class dump_writer
+{
+private:
+    // Sink: exactly one of the two is set
+    std::ostream* out;
+    std::string* str;
+    // Chunk buffer
+    char* buf;
+    size_t len;
+    /// Make room for n more bytes
+    void reserve(size_t n) { if (this->len + n > DUMP_WRITER_CHUNK) this->flush(); }
+public:
+    // No copying
+    NOT_COPYABLE(dump_writer)
+    // Constructors
+    /// Given a stream or a string to append to
+    dump_writer(std::ostream& out);
+    dump_writer(std::string& out);
+    // Destructor -- flushes
+    ~dump_writer();
+    // Hand the buffered text to the sink
+    void flush();
+    // Write text
+    dump_writer& write(const char* s, size_t n);
+    dump_writer& operator<<(const char* s) { return this->write(s, std::strlen(s)); }
+    dump_writer& operator<<(const std::string& s) { return this->write(s.data(), s.size()); }
+    dump_writer& operator<<(char c)
+    {
+        this->reserve(1);
+        this->buf[this->len++] = c;
+        return *this;
+    }
+    // Write an integer in decimal
+    template <typename T, typename = typename std::enable_if<std::is_integral<T>::value>::type>
+    dump_writer& operator<<(T v)
+    {
+        this->reserve(24);
+        this->len = std::to_chars(this->buf + this->len, this->buf + DUMP_WRITER_CHUNK, v).ptr - this->buf;
+        return *this;
+    }
+    /// Right-aligned in a field of the given width
+    template <typename T>
+    dump_writer& pad(T v, int width)
+    {
+        char digits[24];
+        int n = std::to_chars(digits, digits + sizeof(digits), v).ptr - digits;
+        for (; n < width; width--)
+            *this << ' ';
+        return this->write(digits, n);
+    }
+};
+
+#endif
@@ -0,0 +1,64 @@
+/********************************************************************
+* Defines a counter-based random number generator (Philox 4x32-10):
+* the random words at any position of any stream are a pure function
+* of the seed, so streams may be drawn by any thread, in any order
+********************************************************************/
+
+#ifndef PHILOX_H
+#define PHILOX_H
+
+#include <cstdint>
+
+// Rounds and constants of Philox 4x32
+#define PHILOX_ROUNDS 10
+#define PHILOX_M0 0xD2511F53u
+#define PHILOX_M1 0xCD9E8D57u
+#define PHILOX_W0 0x9E3779B9u
+#define PHILOX_W1 0xBB67AE85u
+
+// A philox generator reads the words of one stream of a seed in order;
+// it is a uniform random bit generator, so it drives the standard
+// distributions as well
+class philox
+{
+private:
+    /// Key (the seed) and stream (the high half of the counter)
+    uint32_t key[2];
+    uint64_t stream;
+    /// Position of the next word in the stream
+    uint64_t next;
+    // Mix one 128-bit counter into four random 32-bit words
+    static void round_block(uint32_t k0, uint32_t k1, uint32_t ctr[4])
+    {
+        for (int r = 0; r < PHILOX_ROUNDS; r++) {
+            uint64_t p0 = (uint64_t)PHILOX_M0 * ctr[0], p1 = (uint64_t)PHILOX_M1 * ctr[2];
+            uint32_t c1 = ctr[1], c3 = ctr[3];
+            ctr[0] = (uint32_t)(p1 >> 32) ^ c1 ^ k0;
+            ctr[1] = (uint32_t)p1;
+            ctr[2] = (uint32_t)(p0 >> 32) ^ c3 ^ k1;
+            ctr[3] = (uint32_t)p0;
+            k0 += PHILOX_W0, k1 += PHILOX_W1;
+        }
+    }
+public:
+    typedef uint64_t result_type;
+    // Constructor
+    /// Given the seed and the stream
+    philox(uint64_t seed, uint64_t stream) : key{ (uint32_t)seed, (uint32_t)(seed >> 32) }, stream(stream), next(0) {}
+    // The word at position i of the stream
+    /// Each counter gives two words
+    uint64_t word(uint64_t i) const
+    {
+        uint32_t ctr[4] = { (uint32_t)(i >> 1), (uint32_t)(i >> 33), (uint32_t)this->stream, (uint32_t)(this->stream >> 32) };
+        round_block(this->key[0], this->key[1], ctr);
+        return i & 1 ? (uint64_t)ctr[3] << 32 | ctr[2] : (uint64_t)ctr[1] << 32 | ctr[0];
+    }
+    // Uniform random bit generator interface
+    static constexpr uint64_t min() { return 0; }
+    static constexpr uint64_t max() { return UINT64_MAX; }
+    uint64_t operator()() { return this->word(this->next++); }
+    // A uniform double in [0, 1)
+    double uniform() { return ((*this)() >> 11) * 0x1.0p-53; }
+};
+
+#endif
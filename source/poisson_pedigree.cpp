@@ -7,18 +7,22 @@
 ********************************************************************/
 
 #include "poisson_pedigree.h"
-#include "rec_gen_bp.h"
-#include "bp_message.h"
+#include "pedigree_text.h"
+#include "block_kernels.h"
+#include "thread_pool.h"
+#include "philox.h"
 
+#include <initializer_list>
 #include <algorithm>
 #include <cstring>
 #include <sstream>
+#include <cmath>
 #include <random>
 #include <vector>
 #include <ctime>
 
-INIT_ID(individual_node)
-INIT_ID(coupled_node)
+// Number of locks shared by the lazily-built caches of couples (a power of two)
+#define CACHE_LOCKS 64
 
 INIT_DUMP(individual_node)
 INIT_DUMP(coupled_node)
@@ -27,29 +31,42 @@ INIT_DUMP(poisson_pedigree)
 /************************** INDIVIDUALS ****************************/
 
 // Initialize an individual node given all information
-void individual_node::init(long long id, int genome_size, gene* genome, coupled_node* par, coupled_node* mate)
+/// A NULL store gives the individual a private store of its own, and a
+/// negative slot allocates a new genome in the store
+void individual_node::init(long long id, int genome_size, genome_store* genome, int slot, coupled_node* par, coupled_node* mate)
 {
+    this->enroll();
     id < 0 ? this->set_id() : this->set_id(id);
     this->genome_size = genome_size;
-    this->genome = genome;
+    this->owns_genome = genome == NULL;
+    this->genome = this->owns_genome ? new genome_store(genome_size, 0, GENOME_INDIV_MAJOR) : genome;
+    this->slot = slot < 0 ? this->genome->alloc() : slot;
     this->par = par;
     this->mate = mate;
-    memset(this->genome, 0, sizeof(gene) * genome_size);
 }
 
 // Construct an individual node given the genome size and the ID
 // For use during dump restoration
 individual_node::individual_node(int genome_size, long long id)
-{ init(id, genome_size, new gene[genome_size], NULL, NULL); }
+{ init(id, genome_size, NULL, -1, NULL, NULL); }
 
 // Construct an individual node given the genome size --
 // initializes but does not fill genome
 individual_node::individual_node(int genome_size)
-{ init(-1, genome_size, new gene[genome_size], NULL, NULL); }
+{ init(-1, genome_size, NULL, -1, NULL, NULL); }
+
+// Construct an individual node whose genome lives in the given store
+individual_node::individual_node(genome_store* genome)
+{ init(-1, genome->num_blocks(), genome, -1, NULL, NULL); }
+
+// Construct an individual node whose genome is already in a slot of the
+// given store -- for use when loading binary pedigrees
+individual_node::individual_node(genome_store* genome, int slot, long long id)
+{ init(id, genome->num_blocks(), genome, slot, NULL, NULL); }
 
 // Default constructor
 individual_node::individual_node()
-{ init(-1, 0, NULL, NULL, NULL); }
+{ init(-1, 0, NULL, -1, NULL, NULL); }
 
 // Destructor
 individual_node::~individual_node()
@@ -57,20 +74,31 @@ individual_node::~individual_node()
     /// Remove from children lists if present
     if (this->par != NULL)
         this->par->erase_child(this);
+    this->release();
 }
 individual_node* individual_node::purge()
 {
-    /// Delete genome
-    delete[] this->genome;
+    /// Delete genome if it is not held by a shared store
+    if (this->owns_genome)
+        delete this->genome;
+    this->genome = NULL;
     return this;
 }
 
 // Basic accessors
-/// Return lvalue of block in index b
-gene& individual_node::operator[](int b) { return this->genome[b]; }
 /// Return the genome size
 int individual_node::num_blocks() { return this->genome_size; }
-/// Return the mate coupled node
+/// Get the store holding the genome and the slot within it
+genome_store* individual_node::get_genome() { return this->genome; }
+int individual_node::get_slot() { return this->slot; }
+/// Copy blocks [from, to) of the genome of another individual (returns self)
+individual_node* individual_node::copy_blocks(individual_node* src, int from, int to)
+{
+    this->genome->copy_range(this->slot, *src->genome, src->slot, from, to);
+    return this;
+}
+
+// Return the mate coupled node
 coupled_node* individual_node::couple() { return this->mate; }
 /// Get the parent couple
 coupled_node* individual_node::parent() { return this->par; }
@@ -86,23 +114,75 @@ coupled_node* individual_node::mate_with(individual_node* other)
 coupled_node* individual_node::assign_par(coupled_node* par)
 { return this->par = par; }
 
+// Assign the mate coupled node
+coupled_node* individual_node::assign_couple(coupled_node* mate)
+{ return this->mate = mate; }
+
+// Move the genome into another store (returns self)
+individual_node* individual_node::move_genome(genome_store* store)
+{
+    if (store == this->genome)
+        return this;
+    int slot = store->alloc();
+    store->copy_range(slot, *this->genome, this->slot, 0, this->genome_size);
+    if (this->owns_genome)
+        delete this->genome;
+    this->genome = store;
+    this->slot = slot;
+    this->owns_genome = false;
+    return this;
+}
+
+// Replace the genome with a private copy of the given genes (returns self)
+/// The store starts at the width of the largest gene, so it never repacks
+individual_node* individual_node::set_genome(int genome_size, const gene* genes)
+{
+    if (this->owns_genome)
+        delete this->genome;
+    gene max_gene = 0;
+    for (int b = 0; b < genome_size; b++)
+        max_gene = std::max(max_gene, genes[b]);
+    this->genome_size = genome_size;
+    this->genome = new genome_store(genome_size, max_gene, GENOME_INDIV_MAJOR);
+    this->slot = this->genome->alloc();
+    this->owns_genome = true;
+    for (int b = 0; b < genome_size; b++)
+        this->genome->set(this->slot, b, genes[b]);
+    return this;
+}
+
 // Dump the individual information as a string
 /// -i {id} -c {couple id} -p {parent id} -g {genes}
 std::string individual_node::dump()
 {
-    return "-i " + std::to_string(this->get_id()) + " -c " +
-        std::to_string(this->mate ? this->mate->get_id() : 0) + " -p " +
-        std::to_string(this->par ? this->par->get_id() : 0) + " " +
-        this->dump_genes();
+    std::string d;
+    dump_writer out(d);
+    this->dump(out);
+    out.flush();
+    return d;
+}
+void individual_node::dump(dump_writer& out)
+{
+    out << "-i " << this->get_id() << " -c " << (this->mate ? this->mate->get_id() : 0) <<
+        " -p " << (this->par ? this->par->get_id() : 0) << ' ';
+    this->dump_genes(out);
 }
 /// Dump only the genes: -i {id} -g {genes}
 std::string individual_node::dump_genes()
 {
-    std::string d =  "-g " + std::to_string(this->genome_size);
-    for (int i = 0; i < this->genome_size; i++)
-        d += " " + std::to_string((*this)[i]);
+    std::string d;
+    dump_writer out(d);
+    this->dump_genes(out);
+    out.flush();
     return d;
 }
+void individual_node::dump_genes(dump_writer& out)
+{
+    out << "-g " << this->genome_size;
+    for (int b = 0, end; b < this->genome_size; b = end)
+        for (gene g = this->run(b, end); b < end; b++)
+            out << ' ' << g;
+}
 
 // Rebuild an individual from a dumped string
 individual_node* individual_node::recover_dumped(std::string dump_out, individual_node* indiv)
@@ -115,7 +195,6 @@ individual_node* individual_node::recover_dumped(std::string dump_out, individua
             individual_node* orig = individual_node::get_member_by_id(std::stoll(v[0]));
             if (indiv == orig)
                 return;
-            individual_node::ID_map.erase(indiv->get_id());
             if (orig == NULL)
                 indiv->set_id(std::stoll(v[0]));
             else {
@@ -133,12 +212,10 @@ individual_node* individual_node::recover_dumped(std::string dump_out, individua
         });
         /// Read genome
         frin.add_flag("genome", 'g', -1, [&](std::vector<std::string> v, void* p) {
-            individual_node* indiv = static_cast<individual_node*>(p);
-            delete[] indiv->genome;
-            indiv->genome_size = v.size();
-            indiv->genome = new gene[indiv->genome_size];
+            std::vector<gene> genes(v.size());
             for (int i = 0; i < v.size(); i++)
-                (*indiv)[i] = std::stoll(v[i]);
+                genes[i] = std::stoll(v[i]);
+            static_cast<individual_node*>(p)->set_genome(genes.size(), genes.data());
         });
     }
     // Possess the flag reader
@@ -150,42 +227,54 @@ individual_node* individual_node::recover_dumped(std::string dump_out, individua
 /**************************** COUPLES ******************************/
 
 // Initialize a coupled node given all information
-void coupled_node::init(long long id, std::pair<individual_node*, individual_node*> couple,
-    std::unordered_set<individual_node*> children)
+void coupled_node::init(long long id, std::pair<individual_node*, individual_node*> couple)
 {
+    this->enroll();
     id < 0 ? this->set_id() : this->set_id(id);
-    this->genome_len = -1;
     this->couple = couple;
-    this->children = children;
+    this->ch_data = this->ch_inline;
+    this->ch_size = 0;
+    this->ch_cap = COUPLE_INLINE_CH;
+    this->desc = NULL;
     this->rec_des_blocks = NULL;
     this->all_des_genes = NULL;
     this->min_err = NULL;
-    this->belief = NULL;
 }
 
 // Construct a coupled node given a pair to mate and the ID
 // For use during dump restoration
 coupled_node::coupled_node(long long id)
-{ init(id, { NULL, NULL }, std::unordered_set<individual_node*>()); }
+{ init(id, { NULL, NULL }); }
 
 // Construct a coupled node given a pair to mate
 coupled_node::coupled_node(individual_node* indiv1, individual_node* indiv2)
-{ init(-1, { indiv1, indiv2 }, std::unordered_set<individual_node*>()); }
+{ init(-1, { indiv1, indiv2 }); }
 
 // Construct a coupled node given an extant individual
 coupled_node::coupled_node(individual_node* ext)
-{ init(-1, { ext, ext }, std::unordered_set<individual_node*>()); }
+{ init(-1, { ext, ext }); }
+
+// Default constructor
+coupled_node::coupled_node()
+{ init(-1, { NULL, NULL }); }
 
 // Destructor for coupled node
+coupled_node::~coupled_node()
+{ this->release(); }
 coupled_node* coupled_node::purge()
 {
-    for (individual_node* ch : this->children)
+    for (individual_node* ch : *this)
         ch->assign_par(NULL);
-    delete[] this->rec_des_blocks;
+    if (this->ch_cap > COUPLE_INLINE_CH)
+        delete[] this->ch_data;
+    this->ch_data = this->ch_inline;
+    this->ch_size = 0;
+    this->ch_cap = COUPLE_INLINE_CH;
+    delete this->desc;
+    this->desc = NULL;
+    delete this->rec_des_blocks;
+    this->rec_des_blocks = NULL;
     delete[] this->all_des_genes;
-    for (int b = 0; b <= genome_len; b++)
-        delete this->belief[b];
-    delete[] this->belief;
     return this;
 }
 
@@ -198,9 +287,6 @@ individual_node*& coupled_node::operator[](int index)
 }
 
 // Manipulate genes
-/// Query whether a member of the couple has gene g in block b
-bool coupled_node::has_gene(int b, gene g)
-{ return g && ((*(*this)[0])[b] == g || (*(*this)[1])[b] == g); }
 /// Insert a gene to an unassigned couple member
 coupled_node* coupled_node::insert_gene(int b, gene g)
 { ((*(*this)[0])[b] ? *(*this)[1] : *(*this)[0])[b] = g; return this; }
@@ -209,11 +295,31 @@ coupled_node* coupled_node::insert_gene(int b, gene g)
 individual_node* coupled_node::get_orphan()
 { return (*this)[0]->parent() == NULL ? (*this)[0] : (*this)[1]; }
 
+// Make the child array owned, with room for n children
+void coupled_node::reserve_ch(int n)
+{
+    if (this->ch_cap >= n)
+        return;
+    /// Grow geometrically, staying inline while possible
+    int cap = n <= COUPLE_INLINE_CH ? COUPLE_INLINE_CH : std::max(n, 2 * this->ch_cap);
+    individual_node** data = cap == COUPLE_INLINE_CH ? this->ch_inline : new individual_node*[cap];
+    std::copy(this->ch_data, this->ch_data + this->ch_size, data);
+    if (this->ch_cap > COUPLE_INLINE_CH)
+        delete[] this->ch_data;
+    this->ch_data = data;
+    this->ch_cap = cap;
+}
+
 // Add a child to this couple's progeny
 individual_node* coupled_node::add_child(individual_node* other)
 {
     other->assign_par(this);
-    this->children.insert(other);
+    if (this->is_child(other))
+        return other;
+    delete this->desc;
+    this->desc = NULL;
+    this->reserve_ch(this->ch_size + 1);
+    this->ch_data[this->ch_size++] = other;
     return other;
 }
 
@@ -221,8 +327,8 @@ individual_node* coupled_node::add_child(individual_node* other)
 /// Query for an individual node
 bool coupled_node::is_child(individual_node* other)
 {
-    /// Use the membership test of the map
-    return this->children.find(other) != this->children.end();
+    /// Children are few, so scan them
+    return std::find(this->begin(), this->end(), other) != this->end();
 }
 /// Query for a coupled node
 bool coupled_node::is_child(coupled_node* other)
@@ -238,41 +344,72 @@ bool coupled_node::is_sib(coupled_node *other)
     return other && ((*this)[0]->parent()->is_child(other) || (*this)[1]->parent()->is_child(other));
 }
 /// Query for number of children
-int coupled_node::num_ch() { return this->children.size(); }
+int coupled_node::num_ch() { return this->ch_size; }
 
 // Remove a child from a couple's progeny
 individual_node* coupled_node::erase_child(individual_node *ch)
 {
-    if (this->is_child(ch))
-        this->children.erase(ch);
+    if (!this->is_child(ch))
+        return ch;
+    delete this->desc;
+    this->desc = NULL;
+    /// Keep the order of the remaining children
+    this->reserve_ch(this->ch_size);
+    individual_node** at = std::find(this->begin(), this->end(), ch);
+    std::copy(at + 1, this->end(), at);
+    this->ch_size--;
     return ch;
 }
 
 // Iterating over a coupled_node iterates over its children
 /// Internally, this is represented by iterating over the
-/// children set
-std::unordered_set<individual_node*>::iterator coupled_node::begin()
-{ return this->children.begin(); }
-std::unordered_set<individual_node*>::iterator coupled_node::end()
-{ return this->children.end(); }
+/// child array
+individual_node** coupled_node::begin() { return this->ch_data; }
+individual_node** coupled_node::end() { return this->ch_data + this->ch_size; }
+
+// Adopt a packed array already holding the children, which must outlive
+// the couple (returns self)
+coupled_node* coupled_node::pack_children(individual_node** packed)
+{
+    if (this->ch_cap > COUPLE_INLINE_CH)
+        delete[] this->ch_data;
+    this->ch_data = packed;
+    this->ch_cap = 0;
+    return this;
+}
 
 // Get all extant descendants of a couple
-std::unordered_set<individual_node*> coupled_node::extant_desc(coupled_node* visitor)
-{
-    /// If the visitor is non-NULL and the last visitor, prune
-    if (visitor && visitor == this->last_vis_vert)
-        return std::unordered_set<individual_node*>();
-    this->last_vis_vert = visitor;
-    /// If extant layer reached, return this
-    if ((*this)[0] == (*this)[1])
-        return std::unordered_set<individual_node*>({ (*this)[0] });
-    /// Initialize a descendants set
-    std::unordered_set<individual_node*> desc;
-    /// For all children, add their descendants to this set
-    for (individual_node* ch : (*this)) {
-        auto ret = ch->couple()->extant_desc(visitor);
-        desc.insert(ret.begin(), ret.end());
-    }
+/// As a set of individual indices; the sets of the children are built
+/// before taking the lock, so no lock is held while recursing
+const desc_set& coupled_node::extant_set()
+{
+    desc_set* ret = __atomic_load_n(&this->desc, __ATOMIC_ACQUIRE);
+    if (ret != NULL)
+        return *ret;
+    std::vector<const desc_set*> parts;
+    if ((*this)[0] != (*this)[1])
+        for (individual_node* ch : *this)
+            if (ch->couple())
+                parts.push_back(&ch->couple()->extant_set());
+    return *init_once(this->desc, this->cache_lock(), [&]() {
+        /// The extant layer holds itself
+        if ((*this)[0] == (*this)[1])
+            return new desc_set((*this)[0]->get_index());
+        desc_set* desc = new desc_set();
+        for (const desc_set* part : parts)
+            desc->merge(*part);
+        return desc;
+    });
+}
+/// As individuals in index order, leaving out any in except
+std::vector<individual_node*> coupled_node::extant_desc(const desc_set* except)
+{
+    std::vector<individual_node*> desc;
+    node_pool<individual_node>& indivs = this->arena->pool((individual_node*)NULL);
+    this->extant_set().for_each([&](uint32_t i) {
+        if (!except || !except->contains(i))
+            desc.push_back(indivs[i]);
+    });
     return desc;
 }
 
@@ -280,14 +417,19 @@ std::unordered_set<individual_node*> coupled_node::extant_desc(coupled_node* vis
 /// -i {id} -m {member ids} -c {children ids}
 std::string coupled_node::dump()
 {
-    std::string d =  "-i " + std::to_string(this->get_id()) + " -m 2 " +
-           std::to_string((*this)[0]->get_id()) + " " +
-           std::to_string((*this)[1]->get_id()) + " -c " +
-           std::to_string(this->children.size());
-    for (individual_node* ch : *this)
-        d += " " + std::to_string(ch->get_id());
+    std::string d;
+    dump_writer out(d);
+    this->dump(out);
+    out.flush();
     return d;
 }
+void coupled_node::dump(dump_writer& out)
+{
+    out << "-i " << this->get_id() << " -m 2 " << (*this)[0]->get_id() << ' ' <<
+        (*this)[1]->get_id() << " -c " << this->ch_size;
+    for (individual_node* ch : *this)
+        out << ' ' << ch->get_id();
+}
 
 // Rebuild a couple from a dumped string
 coupled_node* coupled_node::recover_dumped(std::string dump_out, coupled_node* couple)
@@ -300,7 +442,6 @@ coupled_node* coupled_node::recover_dumped(std::string dump_out, coupled_node* c
             coupled_node* orig = coupled_node::get_member_by_id(std::stoll(v[0]));
             if (couple == orig)
                 return;
-            coupled_node::ID_map.erase(couple->get_id());
             if (orig == NULL)
                 couple->set_id(std::stoll(v[0]));
             else {
@@ -327,77 +468,125 @@ coupled_node* coupled_node::recover_dumped(std::string dump_out, coupled_node* c
     return static_cast<coupled_node*>(coupled_node::frin.get_possessor());
 }
 
+// Lazily-built caches
+/// Lock guarding the first touch of this couple's caches
+std::mutex& coupled_node::cache_lock()
+{
+    static std::mutex locks[CACHE_LOCKS];
+    return locks[this->member_id & (CACHE_LOCKS - 1)];
+}
+
 // Extension for recursive symbol-collection
-/// Initialize descendant gene array
-void coupled_node::init_des_blocks()
+/// Build descendant gene array
+des_gene_pool* coupled_node::build_des_blocks()
 {
-    /// Create array
-    this->rec_des_blocks = new std::list<std::pair<gene, int>>[(*this)[0]->num_blocks()]();
+    /// Create pool
+    des_gene_pool* des_blocks = new des_gene_pool();
+    des_blocks->offsets.push_back(0);
     /// Populate for extant node
-    if ((*this)[0] == (*this)[1])
-        for (int i = 0; i < (*this)[0]->num_blocks(); i++)
-            this->rec_des_blocks[i].emplace_back((*(*this)[0])[i], INT32_MAX);
+    if ((*this)[0] == (*this)[1]) {
+        des_blocks->genes.reserve((*this)[0]->num_blocks());
+        for (int i = 0; i < (*this)[0]->num_blocks(); i++) {
+            des_blocks->genes.emplace_back((*(*this)[0])[i], INT32_MAX);
+            des_blocks->offsets.push_back(i + 1);
+        }
+    }
+    return des_blocks;
 }
-/// Get genes at block
-std::list<std::pair<gene, int>>& coupled_node::get_des_genes(int b)
+/// Get descendant gene pool
+const des_gene_pool& coupled_node::get_des_genes()
 {
-    /// Create blocks array on first query
-    if (this->rec_des_blocks == NULL)
-        this->init_des_blocks();
-    /// Fetch required linked list
-    return this->rec_des_blocks[b];
+    /// Create pool on first query
+    return *init_once(this->rec_des_blocks, this->cache_lock(), [&]() { return this->build_des_blocks(); });
 }
 /// Insert a gene at block
 coupled_node* coupled_node::insert_des_gene(int b, gene g, int th)
 {
-    /// Create blocks array on first query
-    if (this->rec_des_blocks == NULL)
-        this->init_des_blocks();
-    /// Insert block
-    this->rec_des_blocks[b].emplace_back(g, th);
+    /// Create pool on first query, open blocks up to b, then insert
+    des_gene_pool* des_blocks = init_once(this->rec_des_blocks, this->cache_lock(), [&]() { return this->build_des_blocks(); });
+    while (des_blocks->offsets.size() <= b)
+        des_blocks->offsets.push_back(des_blocks->genes.size());
+    des_blocks->genes.emplace_back(g, th);
     return this;
 }
 
-// Extension for belief-propagation
-/// Return belief, initializing it to detected genes if null
-bp_message*& coupled_node::message(int block, int domain_sz, long double nullval, int memory_mode)
+// Extension for parsimony
+/// Return min error sets, initializing them to the couple's genes if null
+std::vector<gene>* coupled_node::init_min_err()
+{
+    return init_once(this->min_err, this->cache_lock(), [&]() {
+        std::vector<gene>* sets = new std::vector<gene>[(*this)[0]->num_blocks()]();
+        for (int b = 0; b < (*this)[0]->num_blocks(); b++) {
+            gene g1 = (*(*this)[0])[b], g2 = (*(*this)[1])[b];
+            sets[b] = g1 == g2 ? std::vector<gene>{ g1 } : std::vector<gene>{ std::min(g1, g2), std::max(g1, g2) };
+        }
+        return sets;
+    });
+}
+
+// Gather the genome rows of the members of some couples, in order
+/// Returns the store holding them, or NULL if they are not all in one store
+/// (rows are left NULL for a segmented store)
+static genome_store* couple_rows(std::initializer_list<coupled_node*> couples, const void** rows)
 {
-    /// Initialize the belief if does not already exist
-    if (!this->belief)
-        /// If storing all of the messages, make an appropriate array
-        if (!(memory_mode & MEM_PURGE_CHILD)) {
-            this->genome_len = couple.first->num_blocks();
-            this->belief = new bp_message*[couple.first->num_blocks()]();
-            memset(this->belief, 0, sizeof(*this->belief) * this->genome_len);
+    genome_store* store = (**couples.begin())[0]->get_genome();
+    for (coupled_node* c : couples)
+        for (int i = 0; i < 2; i++) {
+            if ((*c)[i]->get_genome() != store)
+                return NULL;
+            *rows++ = store->row((*c)[i]->get_slot());
         }
-        /// Otherwise, make a size-1 array for the single gene
-        else {
-            this->belief = new bp_message*[1]();
-            *this->belief = NULL;
+    return store;
+}
+/// Gather the runs of the members of some couples of a segmented store
+static void couple_runs(genome_store* store, std::initializer_list<coupled_node*> couples,
+    const genome_segment** runs, const genome_segment** ends)
+{
+    for (coupled_node* c : couples)
+        for (int i = 0; i < 2; i++) {
+            const std::vector<genome_segment>& r = store->segments((*c)[i]->get_slot());
+            *runs++ = r.data(), *ends++ = r.data() + r.size();
         }
-    /// Set the appropriate memory cell for mutation
-    bp_message*& message_alias = memory_mode & MEM_PURGE_CHILD ? *this->belief : this->belief[block];
-    /// Clear the message if it is stale
-    if ((memory_mode & MEM_PURGE_CHILD) && this->last_block != block) {
-        delete message_alias;
-        message_alias = NULL;
-    }
-    /// If this message is computed, return it
-    if (message_alias != NULL)
-        return message_alias;
-    /// If at an extant node, create a message with only those genes
-    if (this->children.empty()) {
-        message_alias = new bp_message(0, domain_sz);
-        message_alias->inc(bp_domain((*(*this)[0])[block], (*(*this)[1])[block]), 1);
+}
+
+// Count number of blocks in which a couple pair shares a gene
+int shared_blocks(coupled_node* u, coupled_node* v, int need, int stop)
+{
+    /// If all four genomes are rows of one store, use the vectorized kernel,
+    /// or walk their runs together if the store is segmented
+    const void* rows[4];
+    genome_store* store = couple_rows({ u, v }, rows);
+    if (store && store->get_layout() == GENOME_SEGMENTS) {
+        const genome_segment *runs[4], *ends[4];
+        couple_runs(store, { u, v }, runs, ends);
+        return count_shared_pair_runs(runs, ends, store->num_blocks(), need, stop);
     }
-    return message_alias;
+    if (store)
+        return count_shared_pair(rows, store->bytes_per_gene(), store->block_stride(), store->num_blocks(), need, stop);
+    /// Otherwise go through the individual accessors
+    int shr = 0, num_blocks = (*u)[0]->num_blocks();
+    for (int i = 0; i < num_blocks && !kernel_settled(shr, num_blocks - i, need, stop); i++)
+        shr += v->has_gene(i, (*(*u)[0])[i]) || v->has_gene(i, (*(*u)[1])[i]);
+    return shr;
 }
 
 // Count number of shared blocks in couple triple
-int shared_blocks(coupled_node* u, coupled_node* v, coupled_node* w)
+int shared_blocks(coupled_node* u, coupled_node* v, coupled_node* w, int need, int stop)
 {
-    int shr = 0;
-    for (int i = 0; i < (*u)[0]->num_blocks(); i++)
+    /// If all six genomes are rows of one store, use the vectorized kernel,
+    /// or walk their runs together if the store is segmented
+    const void* rows[6];
+    genome_store* store = couple_rows({ u, v, w }, rows);
+    if (store && store->get_layout() == GENOME_SEGMENTS) {
+        const genome_segment *runs[6], *ends[6];
+        couple_runs(store, { u, v, w }, runs, ends);
+        return count_shared_triple_runs(runs, ends, store->num_blocks(), need, stop);
+    }
+    if (store)
+        return count_shared_triple(rows, store->bytes_per_gene(), store->block_stride(), store->num_blocks(), need, stop);
+    /// Otherwise go through the individual accessors
+    int shr = 0, num_blocks = (*u)[0]->num_blocks();
+    for (int i = 0; i < num_blocks && !kernel_settled(shr, num_blocks - i, need, stop); i++)
         shr += (v->has_gene(i, (*(*u)[0])[i]) && w->has_gene(i, (*(*u)[0])[i])) ||
             (v->has_gene(i, (*(*u)[1])[i]) && w->has_gene(i, (*(*u)[1])[i]));
     return shr;
@@ -416,27 +605,35 @@ void poisson_pedigree::init(int genome_len, int tfr, int num_gen, int pop_sz,
     this->grades = grades ? grades : new std::unordered_set<coupled_node*>[num_gen];
     this->pop_sz = pop_sz;
     this->deterministic = deterministic;
+    this->genomes.clear();
+    this->genome_layout = GENOME_INDIV_MAJOR;
+    this->max_gene = pop_sz;
+    this->crossover = 0.5;
+    this->seed = (unsigned long long)std::random_device()() << 32 ^ time(NULL);
+    this->num_threads = 1;
     this->all_genes = NULL;
+    this->child_packs.clear();
 }
 
 // Destructor: purge all pedigree members
+/// All nodes live in the arena of the pedigree, so they go at once
 poisson_pedigree* poisson_pedigree::purge()
 {
-    for (int grade = 0; grade < this->num_grade(); grade++)
-        for (coupled_node* couple : this->grades[grade]) {
-            for (individual_node* ch : *couple)
-                delete ch->purge();
-            if ((*couple)[0] != (*couple)[1])
-                delete (*couple)[1]->purge();
-            delete (*couple)[0]->purge();
-            delete couple->purge();
-        }
+    delete this->arena;
+    this->arena = NULL;
     delete[] this->grades;
+    this->grades = NULL;
+    for (genome_store* store : this->genomes)
+        delete store;
+    this->genomes.clear();
     delete[] this->all_genes;
     return this;
 }
 
 // Build a poisson pedigree (4.1)
+/// Draws come from counter-based streams of the seed, by what they are
+/// for, so that children can be filled in by several threads and still
+/// give the same pedigree for the same seed
 poisson_pedigree* poisson_pedigree::build()
 {
 
@@ -444,23 +641,25 @@ poisson_pedigree* poisson_pedigree::build()
     /// Temporarily store individual nodes in a vector as they're generated
     /// Assign a random value used for mating and use as sort key
     std::vector<std::pair<double, individual_node*>> mating_pool;
-    /// The Poisson and uniform distributions used for generating fertility
-    /// rate and mating individuals
-    std::default_random_engine rng(time(NULL));
+    /// The couples of the current grade in mating order, and their
+    /// children in order, so that streams are numbered by position
+    std::vector<coupled_node*> couples;
+    std::vector<individual_node*> children;
+    /// The Poisson distribution used for generating fertility rate
     std::poisson_distribution<int> poiss(this->tfr);
-    std::uniform_real_distribution<double> unif(0, 1);
-    auto generate_fertility = [&](){ return this->deterministic ? this->tfr : poiss(rng); };
+    thread_pool pool(this->num_threads);
 
     // Generate the founder population
     this->cur_gen = this->num_gen - 1;
+    this->max_gene = this->pop_sz / 2 * 2;
     /// If there is an odd member, ignore them, since they cannot mate
     for (int i = 1; i <= this->pop_sz / 2 * 2; i++) {
-        individual_node* indiv = new individual_node(this->genome_len);
+        individual_node* indiv = new individual_node(this->grade_genomes(this->cur_gen));
         /// Give the ith founder gene i in all blocks
         for (int j = 0; j < this->genome_len; j++)
             (*indiv)[j] = i;
         /// Add to list with a random mating parameter
-        mating_pool.push_back({ unif(rng), indiv });
+        mating_pool.push_back({ philox(this->seed, PED_STREAM(PED_STREAM_FOUNDER, this->cur_gen, i)).uniform(), indiv });
     }
 
     // Mate the current generation, generate their children, and perform
@@ -473,20 +672,43 @@ poisson_pedigree* poisson_pedigree::build()
             delete mating_pool.back().second;
             mating_pool.pop_back();
         }
+        couples.clear();
         for (int i = 0; i < mating_pool.size(); i += 2)
-            this->add_to_current(mating_pool[i].second->mate_with(mating_pool[i + 1].second));
-        mating_pool.clear();
-        /// Generate children
-        for (coupled_node* couple : *this) {
-            int nch = generate_fertility();
-            for (int i = 0; i < nch; i++) {
-                individual_node* indiv = new individual_node(this->genome_len);
-                /// Sample blocks randomly from parents
-                for (int j = 0; j < this->genome_len; j++)
-                    (*indiv)[j] = (*(*couple)[unif(rng) < 0.5])[j];
-                mating_pool.push_back({ unif(rng), couple->add_child(indiv) });
-            }
+            couples.push_back(this->add_to_current(mating_pool[i].second->mate_with(mating_pool[i + 1].second)));
+        /// Generate children (nodes and genome slots are made in order)
+        children.clear();
+        for (int k = 0; k < couples.size(); k++) {
+            philox rng(this->seed, PED_STREAM(PED_STREAM_FERTILITY, this->cur_gen, k));
+            int nch = this->deterministic ? this->tfr : poiss(rng);
+            for (int i = 0; i < nch; i++)
+                children.push_back(couples[k]->add_child(new individual_node(this->grade_genomes(this->cur_gen - 1))));
         }
+        /// Sample blocks randomly from parents, 64 at a time from a random
+        /// word, in batches of children across threads
+        mating_pool.resize(children.size());
+        pool.run((children.size() + PED_BUILD_BATCH - 1) / PED_BUILD_BATCH, [&](int task, int thread) {
+            for (int c = task * PED_BUILD_BATCH; c < children.size() && c < (task + 1) * PED_BUILD_BATCH; c++) {
+                individual_node* indiv = children[c];
+                coupled_node* couple = indiv->parent();
+                philox rng(this->seed, PED_STREAM(PED_STREAM_CHILD, this->cur_gen, c));
+                if (this->crossover == 0.5)
+                    for (int w = 0; w * 64 < this->genome_len; w++) {
+                        uint64_t mask = rng();
+                        for (int j = w * 64; j < this->genome_len && j < (w + 1) * 64; j++, mask >>= 1)
+                            (*indiv)[j] = (*(*couple)[mask & 1])[j];
+                    }
+                /// Otherwise copy whole segments, switching parents after a
+                /// geometrically distributed number of blocks
+                else
+                    for (int from = 0, to, p = rng() & 1; from < this->genome_len; from = to, p ^= 1) {
+                        double len = this->crossover <= 0 ? this->genome_len : this->crossover >= 1 ? 0 :
+                            std::floor(std::log1p(-rng.uniform()) / std::log1p(-this->crossover));
+                        to = from + 1 + (int)std::min<double>(len, this->genome_len - from - 1);
+                        indiv->copy_blocks((*couple)[p], from, to);
+                    }
+                mating_pool[c] = { rng.uniform(), indiv };
+            }
+        });
         /// Move down one grade
         this->cur_gen--;
     }
@@ -499,18 +721,25 @@ poisson_pedigree* poisson_pedigree::build()
     for (coupled_node* couple : this->grades[this->num_gen - 1])
         (*couple)[0]->assign_par(couple), (*couple)[1]->assign_par(couple);
 
-    // Return self
-    return this;
+    // Return self, with the children of each grade packed
+    return this->pack_children();
 
 }
 
 // Construct given statistics, build a stochastic pedigree
+/// New nodes go to the pedigree's own arena
 poisson_pedigree::poisson_pedigree(int genome_len, int tfr, int num_gen, int pop_sz, bool deterministic)
-{ init(genome_len, tfr, num_gen, pop_sz, deterministic, new std::unordered_set<coupled_node*>[num_gen]); }
+{
+    init(genome_len, tfr, num_gen, pop_sz, deterministic, new std::unordered_set<coupled_node*>[num_gen]);
+    this->arena = (new node_arena())->activate();
+}
 
 // Default constructor
 poisson_pedigree::poisson_pedigree()
-{ init(10, 3, 3, 10, 0, NULL); }
+{
+    init(10, 3, 3, 10, 0, NULL);
+    this->arena = (new node_arena())->activate();
+}
 
 // Statistic accessors
 int poisson_pedigree::num_blocks() { return this->genome_len; }
@@ -519,6 +748,9 @@ int poisson_pedigree::num_grade() { return this->num_gen; }
 int poisson_pedigree::cur_grade() { return this->cur_gen; }
 int poisson_pedigree::size() { return this->grades[this->cur_gen].size(); }
 
+// Get the arena holding the nodes of the pedigree
+node_arena* poisson_pedigree::nodes() { return this->arena; }
+
 // Adding and accessing coupled nodes in grades
 /// Reset the pedigree current grade pointer to 0 (returns self)
 poisson_pedigree* poisson_pedigree::reset()
@@ -556,141 +788,189 @@ std::unordered_set<coupled_node*>::iterator poisson_pedigree::begin()
 std::unordered_set<coupled_node*>::iterator poisson_pedigree::end()
 { return this->grades[this->cur_gen].end(); }
 
+// Genome storage
+/// Get the genome store of a grade, creating it if necessary
+/// Grade stores are filled by several threads at once (in build() and
+/// symbol collection), so their width is fixed from the largest gene of
+/// the pedigree
+genome_store* poisson_pedigree::grade_genomes(int grade)
+{
+    if (this->genomes.size() < this->num_gen)
+        this->genomes.resize(this->num_gen, NULL);
+    if (this->genomes[grade] == NULL)
+        this->genomes[grade] = (new genome_store(this->genome_len, this->max_gene, this->genome_layout))->fix_width();
+    return this->genomes[grade];
+}
+/// Move the genomes of all individuals into their grades' stores (returns self)
+poisson_pedigree* poisson_pedigree::pack_genomes()
+{
+    /// Find the largest gene so that every store starts at its final width
+    for (int grade = 0; grade < this->num_gen; grade++)
+        for (coupled_node* couple : this->grades[grade])
+            for (int i = 0; i < 2; i++)
+                for (int b = 0; b < this->genome_len; b++)
+                    this->max_gene = std::max(this->max_gene, (gene)(*(*couple)[i])[b]);
+    /// Move each couple's members into the store of the couple's grade
+    for (int grade = 0; grade < this->num_gen; grade++)
+        for (coupled_node* couple : this->grades[grade]) {
+            (*couple)[0]->move_genome(this->grade_genomes(grade));
+            (*couple)[1]->move_genome(this->grade_genomes(grade));
+        }
+    return this;
+}
+/// Choose the layout of grade genome stores (returns self)
+/// Existing stores are rebuilt in the new layout
+poisson_pedigree* poisson_pedigree::set_genome_layout(int genome_layout)
+{
+    if (this->genome_layout == genome_layout)
+        return this;
+    this->genome_layout = genome_layout;
+    std::vector<genome_store*> old_genomes;
+    old_genomes.swap(this->genomes);
+    this->pack_genomes();
+    for (genome_store* store : old_genomes)
+        delete store;
+    return this;
+}
+
+// Generation settings
+/// Chance of a crossover between consecutive blocks (returns self)
+poisson_pedigree* poisson_pedigree::set_crossover(double crossover)
+{
+    this->crossover = crossover;
+    return this;
+}
+/// Seed the random streams of build() (returns self)
+poisson_pedigree* poisson_pedigree::set_seed(unsigned long long seed)
+{
+    this->seed = seed;
+    return this;
+}
+/// Number of threads build() uses (returns self)
+poisson_pedigree* poisson_pedigree::set_threads(int num_threads)
+{
+    this->num_threads = num_threads;
+    return this;
+}
+
+// Child arrays
+/// Pack the children of the couples of a grade into one array held by
+/// the arena, couple after couple in ID order (returns self); the array
+/// of an earlier packing of the grade is reused if the children fit
+poisson_pedigree* poisson_pedigree::pack_children(int grade)
+{
+    std::vector<coupled_node*> couples(this->grades[grade].begin(), this->grades[grade].end());
+    std::sort(couples.begin(), couples.end(), id_less());
+    /// Gather the children first, since unchanged couples still read
+    /// theirs from the array being reused
+    std::vector<individual_node*> children;
+    for (coupled_node* couple : couples)
+        children.insert(children.end(), couple->begin(), couple->end());
+    if (grade >= this->child_packs.size())
+        this->child_packs.resize(grade + 1, { NULL, 0 });
+    std::pair<individual_node**, size_t>& pack = this->child_packs[grade];
+    if (children.size() > pack.second || !pack.first)
+        pack = { this->arena->child_array(children.size()), children.size() };
+    std::copy(children.begin(), children.end(), pack.first);
+    individual_node** packed = pack.first;
+    for (coupled_node* couple : couples) {
+        int n = couple->num_ch();
+        couple->pack_children(packed);
+        packed += n;
+    }
+    return this;
+}
+/// Pack the children of every grade (returns self)
+poisson_pedigree* poisson_pedigree::pack_children()
+{
+    for (int grade = 0; grade < this->num_gen; grade++)
+        this->pack_children(grade);
+    return this;
+}
+
 // Dump the pedigree information as a string
 std::string poisson_pedigree::dump()
+{
+    std::string d;
+    dump_writer out(d);
+    this->dump(out);
+    out.flush();
+    return d;
+}
+void poisson_pedigree::dump(dump_writer& out)
 {
     // Start with general info
-    std::string d = "-B " + std::to_string(this->genome_len) +
-            "\n-A " + std::to_string(this->tfr) +
-            "\n-T " + std::to_string(this->num_gen) +
-            "\n-N " + std::to_string(this->pop_sz) + "\n";
-    // Get sets of all individuals and couples
-    std::unordered_set<individual_node*> ind_set;
-    std::unordered_set<coupled_node*> coup_set;
+    out << "-B " << this->genome_len << "\n-A " << this->tfr <<
+        "\n-T " << this->num_gen << "\n-N " << this->pop_sz << '\n';
+    // Get sets of all individuals and couples, in ID order so that the
+    // same pedigree always dumps the same way
+    std::set<individual_node*, id_less> ind_set;
+    std::set<coupled_node*, id_less> coup_set;
     /// Iterate over self at each generation
     for (this->cur_gen = 0; this->cur_gen < this->num_gen; this->cur_gen++)
         for (coupled_node* couple : *this)
             coup_set.insert(couple), ind_set.insert((*couple)[0]), ind_set.insert((*couple)[1]);
+    /// Children in no couple of the pedigree are still named by their parents
+    for (coupled_node* couple : coup_set)
+        ind_set.insert(couple->begin(), couple->end());
+    /// Their own couples, and mates, as the binary record keeps them
+    std::vector<individual_node*> named(ind_set.begin(), ind_set.end());
+    for (individual_node* indiv : named)
+        if (indiv->couple() && coup_set.insert(indiv->couple()).second)
+            ind_set.insert((*indiv->couple())[0]), ind_set.insert((*indiv->couple())[1]);
     // Dump nodes
     /// Prepare ids first
     for (individual_node* indiv : ind_set)
-        d += "-i " + std::to_string(indiv->get_id()) + "\n";
+        out << "-i " << indiv->get_id() << '\n';
     for (coupled_node* couple : coup_set)
-        d += "-c " + std::to_string(couple->get_id()) + "\n";
+        out << "-c " << couple->get_id() << '\n';
     /// Then individuals
-    for (individual_node* indiv : ind_set)
-        d += "i " + indiv->dump() + "\n";
+    for (individual_node* indiv : ind_set) {
+        out << "i ";
+        indiv->dump(out);
+        out << '\n';
+    }
     /// Then dump couples
-    for (coupled_node* couple : coup_set)
-        d += "c " + couple->dump() + "\n";
-    return d;
+    for (coupled_node* couple : coup_set) {
+        out << "c ";
+        couple->dump(out);
+        out << '\n';
+    }
 }
 
 // Dump the extant population information as a string
 std::string poisson_pedigree::dump_extant()
 {
-    // Dump the size of the extant population and the generation count
-    std::string d = "-n " + std::to_string((*this)[0].size()) +
-            "\n-T " + std::to_string(this->num_gen) +
-            "\n-B " + std::to_string(this->genome_len) + "\n";
-    // Dump the extant individual genetic data
-    for (coupled_node* couple : (*this)[0])
-        d += "i -i " + std::to_string((*couple)[0]->get_id()) + " " + (*couple)[0]->dump_genes() + "\n";
+    std::string d;
+    dump_writer out(d);
+    this->dump_extant(out);
+    out.flush();
     return d;
 }
+void poisson_pedigree::dump_extant(dump_writer& out)
+{
+    // Dump the size of the extant population and the generation count
+    out << "-n " << (*this)[0].size() << "\n-T " << this->num_gen << "\n-B " << this->genome_len << '\n';
+    // Dump the extant individual genetic data, in ID order
+    std::vector<coupled_node*> extant((*this)[0].begin(), (*this)[0].end());
+    std::sort(extant.begin(), extant.end(), id_less());
+    for (coupled_node* couple : extant) {
+        out << "i -i " << (*couple)[0]->get_id() << ' ';
+        (*couple)[0]->dump_genes(out);
+        out << '\n';
+    }
+}
 
 // Rebuild a pedigree from a dumped string
+/// Lines are handed to a dump_parser without copying the dump
 poisson_pedigree* poisson_pedigree::recover_dumped(std::string dump_out, poisson_pedigree* ped)
 {
-    // Initialize the flag reader if not done already
-    int extant_size = -1;
-    if (poisson_pedigree::frin.is_new()) {
-        /// Read block size
-        frin.add_flag("blocks", 'B', 1, [&](std::vector<std::string> v, void* p) {
-            static_cast<poisson_pedigree*>(p)->genome_len = std::stoi(v[0]);
-        });
-        /// Read alpha (TFR)
-        frin.add_flag("alpha", 'A', 1, [&](std::vector<std::string> v, void* p) {
-            static_cast<poisson_pedigree*>(p)->tfr = std::stoi(v[0]);
-        });
-        /// Read number of generations
-        frin.add_flag("generations", 'T', 1, [&](std::vector<std::string> v, void* p) {
-            poisson_pedigree* ped = static_cast<poisson_pedigree*>(p);
-            ped->num_gen = std::stoi(v[0]);
-            delete[] ped->grades;
-            ped->grades = new std::unordered_set<coupled_node*>[ped->num_gen];
-        });
-        /// Read founder size
-        frin.add_flag("founders", 'N', 1, [&](std::vector<std::string> v, void* p) {
-            static_cast<poisson_pedigree*>(p)->pop_sz = std::stoi(v[0]);
-        });
-        /// Read extant size
-        frin.add_flag("extant", 'n', 1, [&](std::vector<std::string> v, void* p) {
-            extant_size = std::stoi(v[0]);
-        });
-        /// Read deterministic flag
-        frin.add_flag("deterministic", 'd', 0, [&](std::vector<std::string> v, void* p) {
-            static_cast<poisson_pedigree*>(p)->deterministic = true;
-        });
-        /// Make a new individual
-        frin.add_flag("individual", 'i', 1, [&](std::vector<std::string> v, void* p) {
-            new individual_node(1, std::stoll(v[0]));
-        });
-        /// Make a new couple
-        frin.add_flag("couple", 'c', 1, [&](std::vector<std::string> v, void* p) {
-            new coupled_node(std::stoll(v[0]));
-        });
+    dump_parser parser(ped);
+    for (size_t b = 0, e; b < dump_out.size(); b = e + 1) {
+        e = std::min(dump_out.find('\n', b), dump_out.size());
+        parser.read_line(dump_out.data() + b, dump_out.data() + e);
     }
-    // Reset the identities of nodes
-    individual_node::clear_ids();
-    coupled_node::clear_ids();
-    // Possess the flag reader
-    poisson_pedigree::frin.possess(ped);
-    // Prepare sets of nodes
-    std::unordered_set<individual_node*> indivs;
-    std::unordered_set<coupled_node*> coups;
-    // Read lines
-    std::istringstream sin(dump_out);
-    std::string line;
-    while(std::getline(sin, line)) {
-        /// Ignore empty line
-        if (line.empty())
-            continue;
-        /// Lines starting with '-' go directly to the pedigree flag reader
-        else if (line[0] == '-')
-            poisson_pedigree::frin.read_flags(line);
-        /// Lines starting with 'i' go to the individual node dump restore
-        else if (line[0] == 'i')
-            indivs.insert(individual_node::recover_dumped(line, new individual_node()));
-        /// Lines starting with 'c' go to the coupled node dump restore
-        else if (line[0] == 'c')
-            coups.insert(coupled_node::recover_dumped(line, new coupled_node()));
-    }
-    // If the extant generation parameter is set, insert the couples to the bottom
-    if (extant_size >= 0) {
-        /// Reset pedigree
-        ped->reset();
-        for (individual_node* indiv : indivs)
-            ped->add_to_current(indiv->mate_with(indiv));
-    }
-    // Otherwise, find the extant population and rebuild the tree
-    else {
-        /// Set current generation to extant
-        ped->reset();
-        /// Extant is self-coupled
-        for (coupled_node* couple : coups)
-            if ((*couple)[0] == (*couple)[1])
-                ped->add_to_current(couple);
-        /// Add the ancestors
-        while (ped->cur_gen < ped->num_gen - 1) {
-            ped->new_grade();
-            for (coupled_node* couple : (*ped)[ped->cur_gen - 1])
-                for (int i = 0; i < 2; i++)
-                    if ((*couple)[i]->parent() && ped->grades[ped->cur_gen].find((*couple)[i]->parent()) == ped->end())
-                        ped->add_to_current((*couple)[i]->parent());
-        }
-    }
-    return ped;
+    return parser.finish();
 }
 
 // Generate pedigrees from shorthand
@@ -703,6 +983,8 @@ poisson_pedigree* poisson_pedigree::parse_shorthand(std::string ped_string)
     /// First line -- number of blocks and number of grades
     int num_block, num_grade;
     sin >> num_block >> num_grade;
+    /// The pedigree comes first, so that its arena receives the nodes
+    poisson_pedigree* ped = new poisson_pedigree(num_block, 0, num_grade, 0, 0);
     /// Couple-creation helper
     auto mk_couple = [&]() {
         std::string raw_id;
@@ -748,7 +1030,7 @@ poisson_pedigree* poisson_pedigree::parse_shorthand(std::string ped_string)
                     (*(*v)[i])[b] = g;
             }
     /// Place in pedigree
-    poisson_pedigree* ped = (new poisson_pedigree(num_block, 0, num_grade, 0, 0))->new_grade();
+    ped->new_grade();
     int num_placed = 0;
     for (coupled_node* v : verts)
         if ((*v)[0] == (*v)[1])
@@ -763,6 +1045,8 @@ poisson_pedigree* poisson_pedigree::parse_shorthand(std::string ped_string)
                 ped->add_to_current((*couple)[0]->parent()), ped->add_to_current((*couple)[1]->parent());
             }
     }
+    ped->max_gene = g;
+    ped->pack_genomes();
     /// Inherit genes
     while (ped->cur_grade()) {
         ped->prev_grade();
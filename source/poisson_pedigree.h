@@ -9,17 +9,24 @@
 #ifndef POISSON_PEDIGREE_H
 #define POISSON_PEDIGREE_H
 
+#include "block_kernels.h"
+#include "genome_store.h"
+#include "node_arena.h"
+#include "desc_set.h"
 #include "flags.h"
 
 #include <unordered_set>
 #include <unordered_map>
 #include <string>
+#include <vector>
 #include <list>
+#include <mutex>
 #include <set>
 
 struct individual_node;
 struct coupled_node;
 class poisson_pedigree;
+class dump_writer;
 
 struct bp_domain;
 
@@ -27,41 +34,82 @@ struct bp_domain;
 
 // Nodes are going to have IDs for the purpose of the dump/restore
 // operation and for labelling isomorphisms
-#define PRIVATE_ID_INFO(T) static long long ID_max; \
-static std::unordered_map<long long, T*> ID_map; \
+// They live in the arena of their pedigree (see node_arena.h), which
+// numbers them densely and maps their IDs to them
+#define PRIVATE_ID_INFO(T) node_arena* arena; \
+int arena_index; \
 long long member_id; \
-void set_id() { set_id(ID_max + 1); }
+void enroll() { this->arena = node_arena::active; \
+this->arena_index = this->arena->pool(this).enroll(this); this->member_id = -1; } \
+void release() { this->arena->pool(this).release(this, this->arena_index, this->member_id); } \
+void set_id() { set_id(this->arena->pool(this).next_id()); }
 #define PUBLIC_ID_ACCESS(T) \
-void set_id(long long id) { ID_map.erase(this->member_id); \
-ID_map.insert({ this->member_id = id, this }); \
-ID_max = ID_max < id ? id : ID_max; } \
-static T* get_member_by_id(long long id) \
-{ auto it = ID_map.find(id); return it == ID_map.end() ? NULL : it->second; } \
+void set_id(long long id) { this->arena->pool(this).unmap(this, this->member_id); \
+this->arena->pool(this).map(this, this->member_id = id); } \
+static T* get_member_by_id(long long id, node_arena* arena = node_arena::active) \
+{ return arena->pool((T*)NULL).find(id); } \
 long long get_id() { return this->member_id; } \
-static void clear_ids() { ID_map.clear(); ID_max = 0; }
-#define INIT_ID(T) long long T::ID_max; std::unordered_map<long long, T*> T::ID_map;
+int get_index() { return this->arena_index; } \
+static void* operator new(size_t size) { return node_arena::active->pool((T*)NULL).alloc(); } \
+static void operator delete(void* node) {}
 #define NOT_COPYABLE(T) T(const T& other); T& operator=(const T&);
 
 // Nodes and trees need to be dumpable and recoverable
 #define DUMPABLE(T) std::string dump(); \
+void dump(dump_writer& out); \
 static T* recover_dumped(std::string dump_out, T*); \
 static flag_reader frin;
 #define INIT_DUMP(T) flag_reader T::frin;
 
+// Ordering nodes by ID rather than by address keeps iteration over
+// ordered containers of nodes reproducible from run to run
+struct id_less
+{
+    template <typename T>
+    bool operator()(T* a, T* b) const { return a->get_id() < b->get_id(); }
+};
+
+// Lazily-built caches may be first touched by several threads at once:
+// the first caller builds the cache under the lock and publishes it,
+// later callers only pay for an acquire load (returns the cache)
+template <typename T, typename F>
+T* init_once(T*& cache, std::mutex& lock, F build)
+{
+    T* ret = __atomic_load_n(&cache, __ATOMIC_ACQUIRE);
+    if (ret != NULL)
+        return ret;
+    std::lock_guard<std::mutex> lk(lock);
+    if ((ret = cache) == NULL)
+        __atomic_store_n(&cache, ret = build(), __ATOMIC_RELEASE);
+    return ret;
+}
+
+// The genes a couple "has" at every block, for recursive symbol
+// collection, pooled in one array: the genes of block b, each with the
+// minimum bushiness it recursively satisfies, are those between offsets
+// b and b + 1. Blocks are filled in increasing order; blocks past the
+// last offset are still empty
+struct des_gene_pool
+{
+    std::vector<std::pair<gene, int>> genes;
+    std::vector<int> offsets;
+    /// Genes at block b
+    const std::pair<gene, int>* begin(int b) const
+    { return this->genes.data() + (b < this->offsets.size() ? this->offsets[b] : this->genes.size()); }
+    const std::pair<gene, int>* end(int b) const
+    { return this->genes.data() + (b + 1 < this->offsets.size() ? this->offsets[b + 1] : this->genes.size()); }
+};
+
 // Iterating over all triples in L
 #define TRIPLE_IT(L) for (auto u = (L).begin(); u != (L).end(); u++)\
 for (auto v = std::next(u); v != (L).end(); v++)\
 for (auto w = std::next(v); w != (L).end(); w++)
 
-// Forward-declarations of classes to be imported
-struct bp_message;
+// Couples keep up to this many children without a heap allocation
+#define COUPLE_INLINE_CH 4
 
 /************************** INDIVIDUALS ****************************/
 
-// We represent a gene as a long long unsigned integer
-// Permissible values: 0 - 18,446,744,073,709,551,615
-typedef long long unsigned gene;
-
 // Individual nodes encapsulate the genome of one person, the parent
 // couple, and the mated coupled node
 struct individual_node
@@ -71,8 +119,11 @@ private:
     PRIVATE_ID_INFO(individual_node)
     // Private members
     /// A genome is a sequence of blocks, each containing one gene
-    /// The length of the gene array is determined by the pedigree
-    gene* genome;
+    /// The genes live in a row of a genome store, usually owned by
+    /// the pedigree; free-standing individuals own a private store
+    genome_store* genome;
+    int slot;
+    bool owns_genome;
     int genome_size;
     /// The parent couple of this individual
     coupled_node* par;
@@ -80,7 +131,7 @@ private:
     coupled_node* mate;
     // Private methods
     /// Initializer method chained from constructors
-    void init(long long id, int genome_size, gene* genome, coupled_node* par, coupled_node* mate);
+    void init(long long id, int genome_size, genome_store* genome, int slot, coupled_node* par, coupled_node* mate);
 public:
     // No copying
     NOT_COPYABLE(individual_node)
@@ -89,18 +140,36 @@ public:
     individual_node(int genome_size, long long id);
     /// Given the size of the genome
     individual_node(int genome_size);
-    /// Default -- leaves genome NULL
+    /// Given a store in which to place the genome
+    individual_node(genome_store* genome);
+    /// Given a store, the slot already holding the genome, and the id
+    individual_node(genome_store* genome, int slot, long long id);
+    /// Default -- leaves genome empty
     individual_node();
     // Destructor
     ~individual_node();
     individual_node* purge();
     // Accessors & mutators
     /// Index a modifiable lvalue of the gene in position b
-    gene& operator[](int b);
+    gene_ref operator[](int b) { return gene_ref(this->genome, this->slot, b); }
+    /// Gene of the run of equal genes holding block b, setting end to the
+    /// first block past the run (b + 1 unless the genome is segmented)
+    gene run(int b, int& end) { return this->genome->run(this->slot, b, end); }
+    /// Copy blocks [from, to) of the genome of another individual (returns self)
+    individual_node* copy_blocks(individual_node* src, int from, int to);
     /// Get the genome size
     int num_blocks();
+    /// Get the store holding the genome and the slot within it
+    genome_store* get_genome();
+    int get_slot();
+    /// Move the genome into another store (returns self)
+    individual_node* move_genome(genome_store* store);
+    /// Replace the genome with a private copy of the given genes (returns self)
+    individual_node* set_genome(int genome_size, const gene* genes);
     /// Return the mate coupled node
     coupled_node* couple();
+    /// Assign the mate coupled node
+    coupled_node* assign_couple(coupled_node* mate);
     /// Mate with another individual and return the couple
     coupled_node* mate_with(individual_node* other);
     /// Get the parent couple
@@ -112,6 +181,7 @@ public:
     /// In addition to dumping full state,individual can dump just
     /// The id and genetic info
     std::string dump_genes();
+    void dump_genes(dump_writer& out);
     // ID Information
     PUBLIC_ID_ACCESS(individual_node)
 };
@@ -132,12 +202,18 @@ private:
     /// Couples of one individual store two copies of that individual
     std::pair<individual_node*, individual_node*> couple;
     /// The children of a coupled node are internally stored in a
-    /// hash table
-    std::unordered_set<individual_node*> children;
+    /// short array, in the order they were added: inline while there
+    /// are few, on the heap once there are more, and in the array of
+    /// their grade once the pedigree packs its children (ch_cap is
+    /// then 0, and the array is copied out again on a change)
+    individual_node** ch_data;
+    int ch_size, ch_cap;
+    individual_node* ch_inline[COUPLE_INLINE_CH];
     // Private methods
     /// Initializer method chained from constructors
-    void init(long long id, std::pair<individual_node*, individual_node*> couple,
-        std::unordered_set<individual_node*> children);
+    void init(long long id, std::pair<individual_node*, individual_node*> couple);
+    /// Make the child array owned, with room for n children
+    void reserve_ch(int n);
 public:
     // No copying
     NOT_COPYABLE(coupled_node)
@@ -149,14 +225,16 @@ public:
     /// Given an extant individual
     coupled_node(individual_node* ext);
     /// Default
-    coupled_node() {}
+    coupled_node();
     // Destructor
+    ~coupled_node();
     coupled_node* purge();
     // Access individuals by indexing
     individual_node*& operator[](int index);
     // Manipulate genes
     /// Query whether a member of the couple has gene g in block b
-    bool has_gene(int b, gene g);
+    bool has_gene(int b, gene g)
+    { return g && ((*this->couple.first)[b] == g || (*this->couple.second)[b] == g); }
     /// Insert a gene to an unassigned couple member
     coupled_node* insert_gene(int b, gene g);
     // Get a parentless member of the couple
@@ -176,59 +254,74 @@ public:
     individual_node* erase_child(individual_node* ch);
     // Iterating over a coupled_node iterates over its children
     /// Internally, this is represented by iterating over the
-    /// children set
-    std::unordered_set<individual_node*>::iterator begin();
-    std::unordered_set<individual_node*>::iterator end();
+    /// child array
+    individual_node** begin();
+    individual_node** end();
+    // Adopt a packed array already holding the children (returns self)
+    coupled_node* pack_children(individual_node** packed);
     // Get all extant descendants of a couple
-    std::unordered_set<individual_node*> extant_desc(coupled_node* visitor=NULL);
+    /// As a set of individual indices, built once from the sets of the
+    /// children (adding or removing a child drops this couple's set)
+    const desc_set& extant_set();
+    /// As individuals in index order, leaving out any in except
+    std::vector<individual_node*> extant_desc(const desc_set* except=NULL);
     // Info dump
     DUMPABLE(coupled_node)
     // ID Information
     PUBLIC_ID_ACCESS(coupled_node)
-// Extension for dfs pruning
+// Lazily-built caches
 private:
-    /// Last vertex and block to visit this during dfs
-    coupled_node *last_vis_vert;
+    /// Set of extant descendants
+    desc_set* desc;
+    /// Lock guarding the first touch of this couple's caches
+    /// Couples share a small table of locks, picked by ID
+    std::mutex& cache_lock();
 // Extension for recursive symbol-collection
 private:
-    /// A linked list of genes this node "has" at each block
-    /// First element is the gene itself; second is the minimum
-    /// bushiness recursively satisfied
-    std::list<std::pair<gene, int>>* rec_des_blocks;
-    /// Initialize descendant gene array
-    void init_des_blocks();
+    /// Genes this node "has" at each block
+    des_gene_pool* rec_des_blocks;
+    /// Build descendant gene pool
+    des_gene_pool* build_des_blocks();
 public:
-    /// Get genes at block
-    std::list<std::pair<gene, int>>& get_des_genes(int b);
-    /// Insert a gene at block
+    /// Get descendant gene pool
+    const des_gene_pool& get_des_genes();
+    /// Insert a gene at block (no earlier than the last block inserted at)
     coupled_node* insert_des_gene(int b, gene g, int th);
 // Extension for BP
-private:
-    /// Belief of gene distributions
-    bp_message** belief;
-    /// Size of genome
-    int genome_len = -1;
-    /// Last block accessed
-    int last_block = -1;
 public:
     /// Genes found in descendants pedigree
     std::unordered_set<gene>* all_des_genes;
-    /// Belief accessor (initializes to current genes if NULL)
-    bp_message*& message(int block, int domain_sz=0, long double nullval=0, int memory_mode=0);
 // Extension for Parsimony
 public:
-    /// Set genes that participate in a minimum-error pair
-    std::set<gene>* min_err;
+    /// Sorted genes that participate in a minimum-error pair
+    std::vector<gene>* min_err;
+    /// Min error sets accessor (initializes to current genes if NULL)
+    std::vector<gene>* init_min_err();
 };
+// Count number of blocks in which a couple pair shares a gene
+/// Given need >= 0, stop once the count is settled against need under the
+/// stopping rule (see block_kernels.h)
+int shared_blocks(coupled_node* u, coupled_node* v, int need = KERNEL_COUNT_ALL, int stop = KERNEL_STOP_SETTLED);
 // Count number of shared blocks in couple triple
-int shared_blocks(coupled_node* u, coupled_node* v, coupled_node* w);
+int shared_blocks(coupled_node* u, coupled_node* v, coupled_node* w, int need = KERNEL_COUNT_ALL, int stop = KERNEL_STOP_SETTLED);
 
 /*********************** POISSON PEDIGREE **************************/
 
+// Random streams of build(): every draw is tied to what it is for (its
+// kind, grade and position in the grade) rather than to the order of
+// the draws, so generation gives the same pedigree on any thread count
+#define PED_STREAM(kind, grade, i) ((unsigned long long)(kind) << 56 | (unsigned long long)(grade) << 32 | (unsigned)(i))
+#define PED_STREAM_FOUNDER 1
+#define PED_STREAM_FERTILITY 2
+#define PED_STREAM_CHILD 3
+// Children whose genomes a thread of build() fills per task
+#define PED_BUILD_BATCH 256
+
 // Pedigrees encapsulate the coupled nodes representing a population
 // and organize other information, such as grades and growth rate
 class poisson_pedigree
 {
+    friend class dump_parser;
 protected:
     // Private members
     /// Population information
@@ -241,6 +334,19 @@ protected:
                         /// exactly alpha
     /// Grades of nodes are represented as unordered sets
     std::unordered_set<coupled_node*>* grades;
+    /// The genomes of each grade are kept in one genome store per grade
+    std::vector<genome_store*> genomes;
+    int genome_layout; /// GENOME_INDIV_MAJOR or GENOME_BLOCK_MAJOR
+    gene max_gene; /// Largest gene value expected in the pedigree
+    double crossover; /// Chance that consecutive blocks come from different
+                      /// parents (0.5 for independent blocks)
+    unsigned long long seed; /// Seed of the random streams of build()
+    int num_threads; /// Threads build() uses (0 for all hardware threads)
+    /// The individuals and couples of the pedigree live in its arena
+    node_arena* arena;
+    /// Packed child array of each grade and its capacity, reused when the
+    /// grade is packed again
+    std::vector<std::pair<individual_node**, size_t>> child_packs;
     // Private methods
     /// Initializer method chained from constructors
     void init(int genome_len, int tfr, int num_gen, int pop_sz, bool deterministic,
@@ -263,6 +369,8 @@ public:
     int num_grade();
     int cur_grade();
     int size();
+    // Get the arena holding the nodes of the pedigree
+    node_arena* nodes();
     // Adding and accessing coupled nodes in grades
     /// Reset the current grade pointer to zero (returns self)
     poisson_pedigree* reset();
@@ -283,11 +391,36 @@ public:
     /// current grade set
     std::unordered_set<coupled_node*>::iterator begin();
     std::unordered_set<coupled_node*>::iterator end();
+    // Genome storage
+    /// Get the genome store of a grade, creating it if necessary
+    genome_store* grade_genomes(int grade);
+    /// Move the genomes of all individuals into their grades' stores (returns self)
+    poisson_pedigree* pack_genomes();
+    // Child arrays
+    /// Pack the children of the couples of a grade, or of every grade,
+    /// into one array per grade (returns self)
+    poisson_pedigree* pack_children(int grade);
+    poisson_pedigree* pack_children();
+    /// Choose the layout of grade genome stores (returns self)
+    poisson_pedigree* set_genome_layout(int genome_layout);
+    // Generation settings
+    /// Chance of a crossover between consecutive blocks (returns self)
+    poisson_pedigree* set_crossover(double crossover);
+    /// Seed the random streams of build() (returns self)
+    poisson_pedigree* set_seed(unsigned long long seed);
+    /// Number of threads build() uses (returns self)
+    poisson_pedigree* set_threads(int num_threads);
     // Info dump
     DUMPABLE(poisson_pedigree)
     /// In addition to dumping full info, a pedigree can dump just
     /// the extant population genetic data for REC-GEN input
     std::string dump_extant();
+    void dump_extant(dump_writer& out);
+    /// Pedigrees can also be dumped as binary records (see pedigree_binary.h)
+    std::string dump_binary();
+    /// Rebuild from a binary record, using its genome matrices in place;
+    /// with extant set, keep only the extant population
+    static poisson_pedigree* recover_binary(char* record, bool extant, poisson_pedigree* ped);
     // Generate pedigrees from shorthand
     static poisson_pedigree* parse_shorthand(std::string ped_string);
 // Extension for BP
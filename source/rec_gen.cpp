@@ -5,6 +5,10 @@
 ********************************************************************/
 
 #include "rec_gen.h"
+#include "block_kernels.h"
+
+#include <algorithm>
+#include <atomic>
 
 // Parameter defaults
 #define DEFAULT_SIB 0.21
@@ -12,12 +16,20 @@
 #define DEFAULT_DEC 0.85
 #define DEFAULT_D 3
 
+// Block-range tasks per thread when couples are too few to keep all threads busy
+#define SYMBOL_TASKS 4
+
 // The Rec-Gen algorithm (Algorithm 1)
 poisson_pedigree* rec_gen::apply_rec_gen()
 {
     /// Reset the pedigree to the extant population
     start_time = std::chrono::high_resolution_clock::now();
     WPRINT(PRINT_HEADER("REC-GEN BEGINS"))
+    WPRINTF("Counting shared blocks with %s kernels", block_kernel_isa())
+    this->pool = new thread_pool(this->num_threads);
+    WPRINTF("Running on %d threads", this->pool->size())
+    /// New couples are constructed in the arena of the pedigree
+    ped->nodes()->activate();
     ped->reset();
     /// Rebuild each grade
     while (!ped->done()) {
@@ -28,24 +40,67 @@ poisson_pedigree* rec_gen::apply_rec_gen()
             WPRINT("Conducting siblinghood test")
             hypergraph *G = test_siblinghood();
             WPRINT("Assigning parents")
+            auto assign_start = std::chrono::high_resolution_clock::now();
             assign_parents(G);
+            ped->pack_children(ped->cur_grade());
+            WPRINTF("Assigned parents in %f seconds", TPLUS(assign_start))
             delete G;
         }
         else ped->next_grade();
         /// Gather genetic information
-        for (coupled_node* v : *ped) {
-            WPRINTF("Collecting symbols for couple %lld", v->get_id())
-            collect_symbols(v);
-        }
+        collect_grade();
     }
     WPRINT(PRINT_HEADER("DONE"))
     /// Set the founders as their own parents
     for (coupled_node *v : *ped)
         (*v)[0]->assign_par(v), (*v)[1]->assign_par(v);
+    delete this->pool;
+    this->pool = NULL;
     /// Return the pedigree
     return ped;
 }
 
+// Reconstruct the genetic material of every couple of the top grade
+/// Each couple only reads the finished lower grades and writes its own
+/// genome, so couples are spread over the thread pool; if there are few
+/// couples, their genomes are also split into block ranges
+void rec_gen::collect_grade()
+{
+    /// Snapshot the grade in ID order
+    std::vector<coupled_node*> grade(this->ped->begin(), this->ped->end());
+    std::sort(grade.begin(), grade.end(), id_less());
+    int n = grade.size(), num_blocks = this->ped->num_blocks();
+    /// Serial collection
+    if (!this->parallel_symbols() || this->pool->size() == 1) {
+        for (coupled_node* v : grade) {
+            WPRINTF("Collecting symbols for couple %lld", v->get_id())
+            collect_symbols(v);
+        }
+        return;
+    }
+    /// Prepare every couple
+    this->pool->run(n, [&](int task, int thread) {
+        WPRINTF("Collecting symbols for couple %lld", grade[task]->get_id())
+        prepare_symbols(grade[task]);
+    });
+    /// Then collect blocks, split into enough ranges to balance the threads;
+    /// writes to a segmented genome split and merge the runs of the whole
+    /// slot, so those genomes are never split
+    int split = std::max(1, std::min(num_blocks, (SYMBOL_TASKS * this->pool->size() + n - 1) / std::max(n, 1)));
+    if (n && (*grade[0])[0]->get_genome()->get_layout() == GENOME_SEGMENTS)
+        split = 1;
+    /// and finish each couple with the last of its ranges
+    std::vector<std::atomic<int>> left(n);
+    for (std::atomic<int>& l : left)
+        l = split;
+    this->pool->run(n * split, [&](int task, int thread) {
+        int part = task % split;
+        collect_blocks(grade[task / split], (long long)num_blocks * part / split, (long long)num_blocks * (part + 1) / split);
+        if (--left[task / split] == 0)
+            finish_symbols(grade[task / split]);
+    });
+}
+
 // Initialization and construction of rec-gen object
 /// Initialize given all info
 void rec_gen::init(poisson_pedigree* ped, std::string work_log, std::string data_log, double sib, double cand, double decay, double rec, int d, long long settings)
@@ -61,6 +116,9 @@ void rec_gen::init(poisson_pedigree* ped, std::string work_log, std::string data
     this->rec = rec;
     this->d = d;
     this->settings = settings;
+    this->no_top = false;
+    this->num_threads = 1;
+    this->pool = NULL;
     this->init();
 }
 /// Initialize based on current members
@@ -90,3 +148,4 @@ rec_gen* rec_gen::set_rec(double rec) { this->rec = rec; return this; }
 rec_gen* rec_gen::set_dec(double decay) { this->decay = decay; return this; }
 rec_gen* rec_gen::set_d(int d) { this->d = d; return this; }
 rec_gen* rec_gen::set_no_top(bool no_top) { this->no_top = no_top; return this; }
+rec_gen* rec_gen::set_threads(int num_threads) { this->num_threads = num_threads; return this; }
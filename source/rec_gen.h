@@ -8,6 +8,7 @@
 #define REC_GEN_H
 
 #include "poisson_pedigree.h"
+#include "thread_pool.h"
 #include "logging.h"
 
 #include <set>
@@ -23,6 +24,7 @@ public:
     {
     public:
         class edge {};
+        virtual ~hypergraph() {}
         virtual void insert_edge(edge e) {}
         virtual void erase_edge(edge e) {}
         virtual bool query_edge(edge e) {}
@@ -35,6 +37,18 @@ protected:
     poisson_pedigree* ped;
     // Reconstruct the genetic material of top-level coupled node v (returns v)
     virtual coupled_node* collect_symbols(coupled_node* v) { return v; }
+    // Split symbol collection, used to reconstruct a grade in parallel:
+    // prepare the per-couple state of v, then reconstruct blocks [from, to)
+    // of v, then finish v once all of its blocks are reconstructed; calls
+    // for different couples, and for disjoint block ranges of one prepared
+    // couple, may run concurrently
+    virtual void prepare_symbols(coupled_node* v) {}
+    virtual void collect_blocks(coupled_node* v, int from, int to) {}
+    virtual void finish_symbols(coupled_node* v) {}
+    // Whether the split symbol collection is available and thread-safe
+    virtual bool parallel_symbols() { return false; }
+    // Reconstruct the genetic material of every couple of the top grade
+    void collect_grade();
     // Perform statistical tests to detect siblinghood (returns hypergraph)
     virtual hypergraph* test_siblinghood() { return new hypergraph(); }
     // Assign parents to the top-level generation based on the siblinghood hypergraph
@@ -54,12 +68,17 @@ protected:
     int d; /// The minimum desirable siblinghood clique size (Definition 4.2, d-richness)
     /// Special properties
     bool no_top; /// Do not attempt to reconstruct topology -- perform symbol collection only
+    /// Parallelism
+    int num_threads; /// Number of threads to use (0 for all hardware threads)
+    thread_pool* pool; /// Threads available while apply_rec_gen runs
 public:
     // Constructors
     /// Given pedigree
     rec_gen(poisson_pedigree* ped);
     /// Given all
     rec_gen(poisson_pedigree* ped, std::string work_log, std::string data_log, double sib, double cand, double decay, double rec, int d, long long settings);
+    // Destructor -- subclasses free their own state
+    virtual ~rec_gen() {}
     // Initialize post-construction -- important if parameters like filenames changed since construction
     rec_gen* init();
     // Access pedigree
@@ -71,6 +90,7 @@ public:
     rec_gen* set_dec(double decay);
     rec_gen* set_d(int d);
     rec_gen* set_no_top(bool no_top);
+    rec_gen* set_threads(int num_threads);
     // Rebuild (returns reconstructed pedigree)
     virtual poisson_pedigree* apply_rec_gen();
 };
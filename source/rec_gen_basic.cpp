@@ -4,6 +4,10 @@
 ********************************************************************/
 
 #include "rec_gen_basic.h"
+#include "block_sampler.h"
+
+#include <algorithm>
+#include <cmath>
 
 /************************ BASIC REC-GEN ****************************/
 
@@ -24,7 +28,7 @@ coupled_node* rec_gen_basic::collect_symbols(coupled_node* par)
                 for (int i = 0; i < this->ped->num_blocks(); i++)
                     /// If there is a shared value in this block, insert it
                     if ((*x)[i] && (*x)[i] == (*y)[i] && (*y)[i] == (*z)[i] && !par->has_gene(i, (*x)[i])) {
-                        DPRINTF("Found gene for couple %lld (%lld %lld) at block %d: %lld", par->get_id(), (*par)[0]->get_id(), (*par)[1]->get_id(), i, (*x)[i])
+                        DPRINTF("Found gene for couple %lld (%lld %lld) at block %d: %lld", par->get_id(), (*par)[0]->get_id(), (*par)[1]->get_id(), i, (gene)(*x)[i])
                         par->insert_gene(i, (*x)[i]);
                     }
             }
@@ -37,13 +41,20 @@ coupled_node* rec_gen_basic::collect_symbols(coupled_node* par)
 rec_gen::hypergraph* rec_gen_basic::test_siblinghood()
 {
     /// Make a new graph
-    rec_gen_basic::hypergraph_basic* G = new hypergraph_basic();
+    rec_gen_basic::hypergraph_basic* G = this->new_hypergraph();
+    double need = this->sib * this->ped->num_blocks();
+    block_sampler* sampler = this->seq_error > 0 ? new block_sampler(this->ped->num_blocks(), this->seq_error) : NULL;
+    /// Only pass or fail matters, so counts stop as soon as they are settled
+    int stop = std::ceil(need);
     /// Iterate over all triples
     TRIPLE_IT(*this->ped) {
         /// If the number of shared blocks is high enough, insert a hyperedge
-        if (shared_blocks(*u, *v, *w) >= this->sib * this->ped->num_blocks())
+        if ((sampler ? sampler->shared_blocks(*u, *v, *w, need) : shared_blocks(*u, *v, *w, stop)) >= need)
             G->insert_edge({ *u, *v, *w });
     }
+    if (sampler)
+        WPRINTF("%s", sampler->summary().c_str())
+    delete sampler;
     /// Return the hypergraph
     return G;
 }
@@ -60,7 +71,8 @@ void rec_gen_basic::assign_parents(rec_gen::hypergraph* GARG)
     WPRINTF("Got a clique of size %d", clique.size())
     while (clique.size() >= d) {
         /// Create a new couple
-        coupled_node* couple = (new individual_node(this->ped->num_blocks()))->mate_with(new individual_node(this->ped->num_blocks()));
+        genome_store* genomes = this->ped->grade_genomes(this->ped->cur_grade());
+        coupled_node* couple = (new individual_node(genomes))->mate_with(new individual_node(genomes));
         DPRINTF("Created new couple %lld (%lld, %lld)", couple->get_id(), (*couple)[0]->get_id(), (*couple)[1]->get_id())
         /// Add all of the clique elements to the couple's children
         for (coupled_node* ch : clique) {
@@ -79,6 +91,21 @@ void rec_gen_basic::assign_parents(rec_gen::hypergraph* GARG)
     }
 }
 
+// Make an empty hypergraph of the selected engine
+rec_gen_basic::hypergraph_basic* rec_gen_basic::new_hypergraph()
+{
+    if (this->clique_mode == CLIQUE_RECURSIVE)
+        return new hypergraph_basic();
+    if (this->clique_mode == CLIQUE_PACKED)
+        return new hypergraph_packed();
+    return new hypergraph_incremental();
+}
+
+// Select the clique extraction engine
+rec_gen_basic* rec_gen_basic::set_clique_mode(int clique_mode) { this->clique_mode = clique_mode; return this; }
+// Select sequential threshold tests
+rec_gen_basic* rec_gen_basic::set_sequential(double error) { this->seq_error = error; return this; }
+
 // Update thresholds
 void rec_gen_basic::update_thresholds()
 {
@@ -150,7 +177,7 @@ bool rec_gen_basic::hypergraph_basic::edge_basic::operator<(const edge_basic& ot
 // Constructor -- create an empty hypergraph
 rec_gen_basic::hypergraph_basic::hypergraph_basic()
 {
-    this->vert = std::map<coupled_node*, std::set<edge_basic>>();
+    this->vert = std::map<coupled_node*, std::set<edge_basic>, id_less>();
     this->adj = std::map<edge_basic, int>();
 }
 
@@ -218,7 +245,7 @@ bool rec_gen_basic::hypergraph_basic::cliquable(coupled_node* vrt)
 }
 /// Find a clique of size d, if one exists
 rec_gen_basic::hypergraph_basic* rec_gen_basic::hypergraph_basic::find_d_clique(
-    std::map<coupled_node*, std::set<edge_basic>>::iterator it, int d)
+    std::map<coupled_node*, std::set<edge_basic>, id_less>::iterator it, int d)
 {
     /// If there is already a clique of the necessary size, terminate
     if (this->clique.size() >= d)
@@ -241,7 +268,7 @@ rec_gen_basic::hypergraph_basic* rec_gen_basic::hypergraph_basic::find_d_clique(
 }
 /// Augment current clique so that it is maximal
 rec_gen_basic::hypergraph_basic* rec_gen_basic::hypergraph_basic::augment_clique(
-    std::map<coupled_node*, std::set<edge_basic>>::iterator it)
+    std::map<coupled_node*, std::set<edge_basic>, id_less>::iterator it)
 {
     /// Make sure the iterator is valid
     if (it == this->vert.end())
@@ -263,3 +290,411 @@ std::set<coupled_node*> rec_gen_basic::hypergraph_basic::extract_clique(int d)
     /// Return clique
     return this->clique;
 }
+
+/********************** INDEXED HYPERGRAPH ************************/
+
+// Constructor -- create an empty hypergraph
+rec_gen_basic::hypergraph_indexed::hypergraph_indexed()
+{ this->barren_d = -1; }
+
+// Vertex number of a couple (-1 if absent, or a new vertex if add)
+int rec_gen_basic::hypergraph_indexed::vertex(coupled_node* v, bool add)
+{
+    auto it = this->index.find(v);
+    if (it != this->index.end())
+        return it->second;
+    if (!add)
+        return -1;
+    /// Number a new vertex
+    int i = this->node.size();
+    this->index[v] = i;
+    this->node.push_back(v);
+    this->degree.push_back(0);
+    this->barren.push_back(false);
+    this->new_vertex(i);
+    return i;
+}
+
+// Change the degree of a vertex, keeping the degree order up to date
+void rec_gen_basic::hypergraph_indexed::add_degree(int v, int delta)
+{
+    this->by_degree.erase({ -this->degree[v], v });
+    this->degree[v] += delta;
+    if (this->degree[v] > 0)
+        this->by_degree.insert({ -this->degree[v], v });
+}
+
+// Extract a maximal hypergraph clique
+/// Candidates left after adding x to clique K with candidates C: those
+/// that complete every pair {u, x} with u in K
+std::vector<int> rec_gen_basic::hypergraph_indexed::narrow(const std::vector<int>& K, const std::vector<int>& C, int x)
+{
+    std::vector<int> ret, tmp, comp;
+    for (int w : C)
+        if (w != x && !this->barren[w])
+            ret.push_back(w);
+    for (int u : K) {
+        comp.clear();
+        if (!this->completions(u, x, comp))
+            return std::vector<int>();
+        tmp.clear();
+        std::set_intersection(ret.begin(), ret.end(), comp.begin(), comp.end(), std::back_inserter(tmp));
+        ret.swap(tmp);
+    }
+    return ret;
+}
+/// Extend clique K to size d, trying candidates by decreasing degree
+bool rec_gen_basic::hypergraph_indexed::find_d_clique(std::vector<int>& K, std::vector<int>& C, int d)
+{
+    /// If there is already a clique of the necessary size, terminate
+    if (K.size() >= d)
+        return true;
+    std::vector<int> order = C;
+    std::sort(order.begin(), order.end(), [&](int u, int v) {
+        return this->degree[u] == this->degree[v] ? u < v : this->degree[u] > this->degree[v];
+    });
+    for (int x : order) {
+        /// Too few candidates remain
+        if (K.size() + C.size() < d)
+            return false;
+        /// Try adding x; if no clique of size d contains it, drop it from the candidates
+        std::vector<int> next = this->narrow(K, C, x);
+        K.push_back(x);
+        if (this->find_d_clique(K, next, d)) {
+            C.swap(next);
+            return true;
+        }
+        K.pop_back();
+        C.erase(std::lower_bound(C.begin(), C.end(), x));
+    }
+    return false;
+}
+/// Seed from vertices by decreasing degree, then grow the first clique of
+/// size d greedily until it is maximal
+std::set<coupled_node*> rec_gen_basic::hypergraph_indexed::extract_clique(int d)
+{
+    if (d != this->barren_d) {
+        std::fill(this->barren.begin(), this->barren.end(), false);
+        this->barren_d = d;
+    }
+    std::vector<int> K, C;
+    bool found = false;
+    for (auto& seed : this->by_degree) {
+        int a = seed.second;
+        if (this->barren[a])
+            continue;
+        /// Any neighbour can join a one-vertex clique
+        K.assign(1, a);
+        C.clear();
+        this->neighbours(a, C);
+        C.erase(std::remove_if(C.begin(), C.end(), [&](int v) { return this->barren[v]; }), C.end());
+        if ((found = this->find_d_clique(K, C, d)))
+            break;
+        /// Remember that the seed lies in no clique of size d
+        this->barren[a] = true;
+    }
+    if (!found)
+        return std::set<coupled_node*>();
+    /// Augment greedily by decreasing degree until no candidates remain
+    while (!C.empty()) {
+        int x = *std::min_element(C.begin(), C.end(), [&](int u, int v) {
+            return this->degree[u] == this->degree[v] ? u < v : this->degree[u] > this->degree[v];
+        });
+        C = this->narrow(K, C, x);
+        K.push_back(x);
+    }
+    /// Return clique
+    std::set<coupled_node*> clique;
+    for (int v : K)
+        clique.insert(this->node[v]);
+    return clique;
+}
+
+/******************** INCREMENTAL HYPERGRAPH ***********************/
+
+// Make room for the edges of a newly numbered vertex
+void rec_gen_basic::hypergraph_incremental::new_vertex(int v)
+{ this->link.emplace_back(); }
+
+// Edge key of a hyperedge (first vertex -1 if a vertex is absent)
+rec_gen_basic::hypergraph_incremental::edge_key rec_gen_basic::hypergraph_incremental::key(edge_basic e, bool add)
+{
+    edge_key k = { { this->vertex(e.a, add), this->vertex(e.b, add), this->vertex(e.c, add) } };
+    if (k.v[0] < 0 || k.v[1] < 0 || k.v[2] < 0)
+        k.v[0] = -1;
+    std::sort(k.v, k.v + 3);
+    return k;
+}
+
+// Add or remove the adjacency entries of an edge
+void rec_gen_basic::hypergraph_incremental::link_edge(const edge_key& k)
+{
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++)
+            if (i != j) {
+                std::vector<int>& l = this->link[k.v[i]][k.v[j]];
+                int w = k.v[3 - i - j];
+                l.insert(std::lower_bound(l.begin(), l.end(), w), w);
+            }
+        this->add_degree(k.v[i], 1);
+    }
+}
+void rec_gen_basic::hypergraph_incremental::unlink_edge(const edge_key& k)
+{
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++)
+            if (i != j) {
+                auto it = this->link[k.v[i]].find(k.v[j]);
+                std::vector<int>& l = it->second;
+                l.erase(std::lower_bound(l.begin(), l.end(), k.v[3 - i - j]));
+                if (l.empty())
+                    this->link[k.v[i]].erase(it);
+            }
+        this->add_degree(k.v[i], -1);
+    }
+}
+
+// Remove a vertex and all of its edges
+void rec_gen_basic::hypergraph_incremental::remove_vertex(int v)
+{
+    /// Collect each edge once, from its two other vertices in increasing order
+    std::vector<edge_key> edges;
+    for (auto& l : this->link[v])
+        for (int w : l.second)
+            if (l.first < w) {
+                edge_key k = { { v, l.first, w } };
+                std::sort(k.v, k.v + 3);
+                edges.push_back(k);
+            }
+    for (edge_key& k : edges) {
+        this->mult.erase(k);
+        this->unlink_edge(k);
+    }
+}
+
+// The w such that {u, x, w} is an edge, in increasing order
+bool rec_gen_basic::hypergraph_incremental::completions(int u, int x, std::vector<int>& out)
+{
+    auto it = this->link[u].find(x);
+    if (it == this->link[u].end())
+        return false;
+    out.insert(out.end(), it->second.begin(), it->second.end());
+    return true;
+}
+
+// The vertices sharing an edge with a, in increasing order
+void rec_gen_basic::hypergraph_incremental::neighbours(int a, std::vector<int>& out)
+{
+    size_t n = out.size();
+    for (auto& l : this->link[a])
+        out.push_back(l.first);
+    std::sort(out.begin() + n, out.end());
+}
+
+// Insert an edge to the hypergraph
+void rec_gen_basic::hypergraph_incremental::insert_edge(edge_basic e)
+{
+    edge_key k = this->key(e, true);
+    /// Maximum edge degree is 2 (per definition 3.11)
+    int& m = this->mult[k];
+    if (m++ == 0)
+        this->link_edge(k);
+    m = std::min(m, 2);
+    /// New edges may create cliques, so forget barren vertices at the next extraction
+    this->barren_d = -1;
+}
+
+// Remove an edge from the hypergraph
+void rec_gen_basic::hypergraph_incremental::erase_edge(edge_basic e)
+{
+    /// Decrement the number of occurrences of the edge by one, unlinking it at zero
+    edge_key k = this->key(e, false);
+    auto it = k.v[0] < 0 ? this->mult.end() : this->mult.find(k);
+    if (it != this->mult.end() && --it->second <= 0) {
+        this->mult.erase(it);
+        this->unlink_edge(k);
+    }
+    /// Also erase vertices if they have two assigned parents
+    for (coupled_node* v : e)
+        if (v->get_orphan()->parent() != NULL && this->vertex(v, false) >= 0)
+            this->remove_vertex(this->vertex(v, false));
+}
+
+// Check whether an edge is in the hypergraph
+bool rec_gen_basic::hypergraph_incremental::query_edge(edge_basic e)
+{
+    edge_key k = this->key(e, false);
+    return k.v[0] >= 0 && this->mult.find(k) != this->mult.end();
+}
+
+// Query number of edges
+int rec_gen_basic::hypergraph_incremental::num_edge()
+{ return this->mult.size(); }
+
+/********************** PACKED HYPERGRAPH **************************/
+
+// Constructor -- create an empty hypergraph
+rec_gen_basic::hypergraph_packed::hypergraph_packed()
+{
+    this->live = 0;
+    this->adj_start.assign(1, 0);
+}
+
+// Make room for the edges of a newly numbered vertex
+/// Its adjacency slice is empty until the next build
+void rec_gen_basic::hypergraph_packed::new_vertex(int v)
+{ this->adj_start.push_back(this->adj.size()); }
+
+// Packed edge of a hyperedge (false if a vertex is absent)
+bool rec_gen_basic::hypergraph_packed::key(edge_basic e, bool add, packed_edge& k)
+{
+    int a = this->vertex(e.a, add), b = this->vertex(e.b, add), c = this->vertex(e.c, add);
+    if (a < 0 || b < 0 || c < 0)
+        return false;
+    k = { { (uint32_t)a, (uint32_t)b, (uint32_t)c } };
+    std::sort(k.v, k.v + 3);
+    return true;
+}
+
+// Merge the pending edges and rebuild the arrays
+/// Multiplicities add up and are capped at 2 (per definition 3.11), as if
+/// the pending edges had been inserted one at a time; dead edges go
+void rec_gen_basic::hypergraph_packed::build()
+{
+    if (this->pending.empty())
+        return;
+    std::sort(this->pending.begin(), this->pending.end());
+    std::vector<packed_edge> edges;
+    std::vector<uint8_t> mult;
+    edges.reserve(this->live + this->pending.size());
+    mult.reserve(this->live + this->pending.size());
+    size_t i = 0, j = 0;
+    while (i < this->edges.size() || j < this->pending.size()) {
+        /// Take the smaller of the next old edge and the next pending one
+        bool old = j == this->pending.size() || (i < this->edges.size() && !(this->pending[j] < this->edges[i]));
+        packed_edge k = old ? this->edges[i] : this->pending[j];
+        int m = 0;
+        if (i < this->edges.size() && this->edges[i] == k)
+            m += this->mult[i++];
+        for (; j < this->pending.size() && this->pending[j] == k; j++)
+            m++;
+        if (m > 0)
+            edges.push_back(k), mult.push_back(std::min(m, 2));
+    }
+    this->edges.swap(edges);
+    this->mult.swap(mult);
+    this->pending = std::vector<packed_edge>();
+    this->live = this->edges.size();
+    /// Lay out the adjacency slices: each edge has two entries at each of
+    /// its vertices
+    int n = this->node.size();
+    std::fill(this->degree.begin(), this->degree.end(), 0);
+    for (const packed_edge& k : this->edges)
+        for (int t = 0; t < 3; t++)
+            this->degree[k.v[t]]++;
+    this->adj_start.assign(n + 1, 0);
+    for (int u = 0; u < n; u++)
+        this->adj_start[u + 1] = this->adj_start[u] + 2 * this->degree[u];
+    this->adj.resize(this->adj_start[n]);
+    std::vector<size_t> fill(this->adj_start.begin(), this->adj_start.end() - 1);
+    for (size_t e = 0; e < this->edges.size(); e++)
+        for (int t = 0; t < 3; t++) {
+            uint32_t u = this->edges[e].v[t], x = this->edges[e].v[(t + 1) % 3], w = this->edges[e].v[(t + 2) % 3];
+            this->adj[fill[u]++] = { x, w, (uint32_t)e };
+            this->adj[fill[u]++] = { w, x, (uint32_t)e };
+        }
+    for (int u = 0; u < n; u++)
+        std::sort(this->adj.begin() + this->adj_start[u], this->adj.begin() + this->adj_start[u + 1],
+            [](const adj_entry& p, const adj_entry& q) { return p.x != q.x ? p.x < q.x : p.w < q.w; });
+    this->by_degree.clear();
+    for (int u = 0; u < n; u++)
+        if (this->degree[u] > 0)
+            this->by_degree.insert({ -this->degree[u], u });
+}
+
+// Mark an edge dead
+void rec_gen_basic::hypergraph_packed::kill_edge(size_t e)
+{
+    this->mult[e] = 0;
+    this->live--;
+    for (int t = 0; t < 3; t++)
+        this->add_degree(this->edges[e].v[t], -1);
+}
+
+// The live w such that {u, x, w} is an edge, in increasing order
+bool rec_gen_basic::hypergraph_packed::completions(int u, int x, std::vector<int>& out)
+{
+    auto end = this->adj.begin() + this->adj_start[u + 1];
+    auto it = std::lower_bound(this->adj.begin() + this->adj_start[u], end, (uint32_t)x,
+        [](const adj_entry& p, uint32_t x) { return p.x < x; });
+    bool any = false;
+    for (; it != end && it->x == (uint32_t)x; it++)
+        if (this->mult[it->e])
+            out.push_back(it->w), any = true;
+    return any;
+}
+
+// The vertices sharing a live edge with a, in increasing order
+void rec_gen_basic::hypergraph_packed::neighbours(int a, std::vector<int>& out)
+{
+    size_t n = out.size();
+    for (size_t i = this->adj_start[a]; i < this->adj_start[a + 1]; i++)
+        if (this->mult[this->adj[i].e] && (out.size() == n || out.back() != (int)this->adj[i].x))
+            out.push_back(this->adj[i].x);
+}
+
+// Insert an edge to the hypergraph
+void rec_gen_basic::hypergraph_packed::insert_edge(edge_basic e)
+{
+    packed_edge k;
+    this->key(e, true, k);
+    this->pending.push_back(k);
+    /// New edges may create cliques, so forget barren vertices at the next extraction
+    this->barren_d = -1;
+}
+
+// Remove an edge from the hypergraph
+void rec_gen_basic::hypergraph_packed::erase_edge(edge_basic e)
+{
+    this->build();
+    /// Decrement the number of occurrences of the edge by one, killing it at zero
+    packed_edge k;
+    if (this->key(e, false, k)) {
+        size_t i = std::lower_bound(this->edges.begin(), this->edges.end(), k) - this->edges.begin();
+        if (i < this->edges.size() && this->edges[i] == k && this->mult[i] && !--this->mult[i])
+            this->kill_edge(i);
+    }
+    /// Also erase vertices if they have two assigned parents
+    for (coupled_node* v : e) {
+        int u = this->vertex(v, false);
+        if (v->get_orphan()->parent() != NULL && u >= 0)
+            for (size_t a = this->adj_start[u]; a < this->adj_start[u + 1]; a++)
+                if (this->mult[this->adj[a].e])
+                    this->kill_edge(this->adj[a].e);
+    }
+}
+
+// Check whether an edge is in the hypergraph
+bool rec_gen_basic::hypergraph_packed::query_edge(edge_basic e)
+{
+    this->build();
+    packed_edge k;
+    if (!this->key(e, false, k))
+        return false;
+    auto it = std::lower_bound(this->edges.begin(), this->edges.end(), k);
+    return it != this->edges.end() && *it == k && this->mult[it - this->edges.begin()];
+}
+
+// Query number of edges
+int rec_gen_basic::hypergraph_packed::num_edge()
+{
+    this->build();
+    return this->live;
+}
+
+// Extract a maximal hypergraph clique
+std::set<coupled_node*> rec_gen_basic::hypergraph_packed::extract_clique(int d)
+{
+    this->build();
+    return hypergraph_indexed::extract_clique(d);
+}
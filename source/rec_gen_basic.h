@@ -9,9 +9,17 @@
 #include "rec_gen.h"
 
 #include <initializer_list>
+#include <unordered_map>
+#include <cstdint>
+#include <vector>
 #include <map>
 #include <set>
 
+// Clique extraction engines
+#define CLIQUE_RECURSIVE 0
+#define CLIQUE_INCREMENTAL 1
+#define CLIQUE_PACKED 2
+
 // The rec_gen_basic class is a basic implementation of the Rec-Gen algorithm
 // presented in the paper "Efficient Reconstruction of Stochastic Pedigrees"
 class rec_gen_basic : public rec_gen
@@ -64,15 +72,15 @@ public:
     protected:
         // Graph information
         /// Vertex set -- set of all vertices and hyperdges that contain them
-        std::map<coupled_node*, std::set<edge_basic>> vert;
+        std::map<coupled_node*, std::set<edge_basic>, id_less> vert;
         /// Adjacency map -- set of all edges and their multiplicities
         std::map<edge_basic, int> adj;
         /// Clique currently under construction
         std::set<coupled_node*> clique;
         // Recursively build a maximal clique
-        hypergraph_basic* augment_clique(std::map<coupled_node*, std::set<edge_basic>>::iterator it);
+        hypergraph_basic* augment_clique(std::map<coupled_node*, std::set<edge_basic>, id_less>::iterator it);
         // Add d more elementa to the current clique
-        hypergraph_basic* find_d_clique(std::map<coupled_node*, std::set<edge_basic>>::iterator it, int d);
+        hypergraph_basic* find_d_clique(std::map<coupled_node*, std::set<edge_basic>, id_less>::iterator it, int d);
         // Check whether vertex can be added to clique
         bool cliquable(coupled_node* vrt);
     public:
@@ -86,7 +94,145 @@ public:
         // Extracts an arbitrary maximal clique of size at least
         virtual std::set<coupled_node*> extract_clique(int d);
     };
+    // Hypergraph whose vertices are numbered densely, on which the clique
+    // search runs; subclasses keep the edges and answer which vertices
+    // complete a pair, and seeds are taken by decreasing degree
+    class hypergraph_indexed : public hypergraph_basic
+    {
+    protected:
+        // Vertices are numbered densely in order of first appearance
+        std::unordered_map<coupled_node*, int> index;
+        std::vector<coupled_node*> node;
+        // Number of edges at each vertex, and vertices by decreasing degree
+        std::vector<int> degree;
+        std::set<std::pair<int, int>> by_degree;
+        // Vertices known to lie in no clique of size barren_d (-1 if unknown)
+        /// Erasing edges never creates cliques, so this survives between extractions
+        std::vector<bool> barren;
+        int barren_d;
+        // Vertex number of a couple (-1 if absent, or a new vertex if add)
+        int vertex(coupled_node* v, bool add);
+        // Make room for the edges of a newly numbered vertex
+        virtual void new_vertex(int v) = 0;
+        // Change the degree of a vertex
+        void add_degree(int v, int delta);
+        // The w such that {u, x, w} is an edge, in increasing order
+        /// Appends to out; returns whether any was found
+        virtual bool completions(int u, int x, std::vector<int>& out) = 0;
+        // The vertices sharing an edge with a, in increasing order
+        /// Appends to out
+        virtual void neighbours(int a, std::vector<int>& out) = 0;
+        // Extend clique K to size d using candidates C (the vertices that
+        // complete every pair of K); on success C holds the candidates left
+        bool find_d_clique(std::vector<int>& K, std::vector<int>& C, int d);
+        // Candidates left after adding x to clique K with candidates C
+        std::vector<int> narrow(const std::vector<int>& K, const std::vector<int>& C, int x);
+    public:
+        // Constructor
+        hypergraph_indexed();
+        // Extracts a maximal clique of size at least d
+        virtual std::set<coupled_node*> extract_clique(int d);
+    };
+    // Hypergraph that keeps per-vertex adjacency lists up to date as edges
+    // are erased, so that repeated clique extraction does not rescan the
+    // whole graph
+    class hypergraph_incremental : public hypergraph_indexed
+    {
+    protected:
+        // Adjacency -- link[u][v] is the sorted list of all w such that
+        // {u, v, w} is an edge
+        std::vector<std::unordered_map<int, std::vector<int>>> link;
+        // Edge multiplicities, keyed by sorted vertex numbers
+        struct edge_key
+        {
+            int v[3];
+            bool operator==(const edge_key& ot) const { return v[0] == ot.v[0] && v[1] == ot.v[1] && v[2] == ot.v[2]; }
+        };
+        struct edge_hash
+        {
+            size_t operator()(const edge_key& k) const
+            { return ((size_t)k.v[0] * 0x9E3779B97F4A7C15ULL ^ (size_t)k.v[1]) * 0x9E3779B97F4A7C15ULL ^ (size_t)k.v[2]; }
+        };
+        std::unordered_map<edge_key, int, edge_hash> mult;
+        // Edge key of a hyperedge (first vertex -1 if a vertex is absent)
+        edge_key key(edge_basic e, bool add);
+        // Inherited hooks
+        virtual void new_vertex(int v);
+        virtual bool completions(int u, int x, std::vector<int>& out);
+        virtual void neighbours(int a, std::vector<int>& out);
+        // Add or remove the adjacency entries of an edge
+        void link_edge(const edge_key& k);
+        void unlink_edge(const edge_key& k);
+        // Remove a vertex and all of its edges
+        void remove_vertex(int v);
+    public:
+        // Inherited methods
+        virtual void insert_edge(edge_basic e);
+        virtual void erase_edge(edge_basic e);
+        virtual bool query_edge(edge_basic e);
+        virtual int num_edge();
+    };
+    // Hypergraph that keeps its edges in flat arrays: edges are a sorted vector of packed vertex-number triples,
+    // and each vertex has a slice of one adjacency array listing, for
+    // each of its edges, the two other vertices both ways round. Inserted
+    // edges are buffered and the arrays are rebuilt in bulk when the
+    // graph is next read; erased edges are only marked dead.
+    class hypergraph_packed : public hypergraph_indexed
+    {
+    protected:
+        // Sorted vertex numbers of an edge
+        struct packed_edge
+        {
+            uint32_t v[3];
+            bool operator<(const packed_edge& ot) const
+            { return v[0] != ot.v[0] ? v[0] < ot.v[0] : v[1] != ot.v[1] ? v[1] < ot.v[1] : v[2] < ot.v[2]; }
+            bool operator==(const packed_edge& ot) const { return v[0] == ot.v[0] && v[1] == ot.v[1] && v[2] == ot.v[2]; }
+        };
+        // Edges, sorted and unique, with their multiplicities (0 once dead)
+        std::vector<packed_edge> edges;
+        std::vector<uint8_t> mult;
+        int live;
+        // Edges inserted since the last build, in insertion order
+        std::vector<packed_edge> pending;
+        // Adjacency -- the entries of vertex u are adj[adj_start[u]] to
+        // adj[adj_start[u + 1]]; entry (x, w, e) says that edge e is
+        // {u, x, w}, and entries are sorted by x, then w
+        struct adj_entry
+        {
+            uint32_t x, w, e;
+        };
+        std::vector<adj_entry> adj;
+        std::vector<size_t> adj_start;
+        // Packed edge of a hyperedge (false if a vertex is absent)
+        bool key(edge_basic e, bool add, packed_edge& k);
+        // Merge the pending edges and rebuild the arrays
+        void build();
+        // Mark an edge dead
+        void kill_edge(size_t e);
+        // Inherited hooks
+        /// Only live edges count
+        virtual void new_vertex(int v);
+        virtual bool completions(int u, int x, std::vector<int>& out);
+        virtual void neighbours(int a, std::vector<int>& out);
+    public:
+        // Constructor
+        hypergraph_packed();
+        // Inherited methods
+        virtual void insert_edge(edge_basic e);
+        virtual void erase_edge(edge_basic e);
+        virtual bool query_edge(edge_basic e);
+        virtual int num_edge();
+        // Extracts a maximal clique of size at least d, once the pending
+        // edges are in
+        virtual std::set<coupled_node*> extract_clique(int d);
+    };
 protected:
+    // Make an empty hypergraph of the selected engine
+    hypergraph_basic* new_hypergraph();
+    // Clique extraction engine (CLIQUE_RECURSIVE, CLIQUE_INCREMENTAL or CLIQUE_PACKED)
+    int clique_mode = CLIQUE_INCREMENTAL;
+    // Error bound of the sequential threshold tests (exact tests if 0)
+    double seq_error = 0;
     // Reconstruct the genetic material of top-level coupled node v (returns v)
     virtual coupled_node* collect_symbols(coupled_node* v);
     // Perform statistical tests to detect siblinghood (returns hypergraph)
@@ -99,6 +245,11 @@ public:
     // Constructors
     /// Inherit
     using rec_gen::rec_gen;
+    // Select the clique extraction engine
+    rec_gen_basic* set_clique_mode(int clique_mode);
+    // Decide the shared-block thresholds with sequential tests of the
+    // given error bound (0 for exact counts)
+    rec_gen_basic* set_sequential(double error);
 };
 
 #endif
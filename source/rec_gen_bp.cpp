@@ -6,85 +6,198 @@
 #include "rec_gen_bp.h"
 #include "bp_message.h"
 
-#include <cstring>
+#include <algorithm>
 #include <cmath>
 
 // The rec_gen_bp class implements belief-propagation symbol collection
-// Override: reconstruct the genetic material of top-level coupled node v (returns v)
-coupled_node* rec_gen_bp::collect_symbols(coupled_node *v)
+// Override: initialize the descendant gene sets of v
+void rec_gen_bp::prepare_symbols(coupled_node *v)
 {
     /// TODO: Make this conform to memory-saving strategies, too?
     /// Initialize sets of genes
     v->all_des_genes = new std::unordered_set<gene>[this->ped->num_blocks()]();
-    if (this->ped->all_genes == NULL) {
-        this->ped->all_genes = new std::unordered_set<gene>[this->ped->num_blocks()]();
+    init_once(this->ped->all_genes, this->genes_lock, [&]() {
+        std::unordered_set<gene>* all_genes = new std::unordered_set<gene>[this->ped->num_blocks()]();
         for (auto ext : (*this->ped)[0]) {
             ext->all_des_genes = new std::unordered_set<gene>[this->ped->num_blocks()]();
             for (int b = 0; b < this->ped->num_blocks(); b++) {
-                this->ped->all_genes[b].insert((*(*ext)[0])[b]);
+                all_genes[b].insert((*(*ext)[0])[b]);
                 ext->all_des_genes[b].insert((*(*ext)[0])[b]);
             }
         }
-    }
-    /// Iterate over all blocks
-    for (int b = 0; b < this->ped->num_blocks(); b++) {
+        return all_genes;
+    });
+}
+
+// Override: reconstruct blocks [from, to) of top-level coupled node v
+/// Messages are computed a tile of blocks at a time, so that the subtree
+/// is walked once per tile rather than once per block
+void rec_gen_bp::collect_blocks(coupled_node *v, int from, int to)
+{
+    for (int b0 = from; b0 < to; b0 = (b0 / BP_TILE + 1) * BP_TILE) {
+        int b1 = std::min(to, (b0 / BP_TILE + 1) * BP_TILE);
         /// Find the set of all genes in subtree
-        for (auto ext : *v)
-            for (gene g : ext->couple()->all_des_genes[b])
-                v->all_des_genes[b].insert(g);
-        /// Pick maximum pair
-        bp_message* msg = &compute_message_at(v, b);
-        bp_domain genes = msg->extract_max();
-        v->insert_gene(b, genes[0]), v->insert_gene(b, genes[1]);
-        DPRINTF("For couple %lld at position %d found genes %lld and %lld (marginal: %llf)", v->get_id(), b, genes[0], genes[1], (*v->message(b))[genes])
-        /// Purge pairs information if in memory-saving mode
-        if (this->memory_mode & MEM_PURGE_PAIRS)
-            msg->purge();
+        for (int b = b0; b < b1; b++)
+            for (auto ext : *v)
+                for (gene g : ext->couple()->all_des_genes[b])
+                    v->all_des_genes[b].insert(g);
+        compute_messages(v, b0, b1);
+        /// Pick maximum pairs
+        for (int b = b0; b < b1; b++) {
+            bp_message* msg = message_at(v, b);
+            bp_domain genes = msg->extract_max();
+            v->insert_gene(b, genes[0]), v->insert_gene(b, genes[1]);
+            DPRINTF("For couple %lld at position %d found genes %lld and %lld (marginal: %Lf)", v->get_id(), b, genes[0], genes[1], msg->value(genes))
+            this->cache->release(v, b);
+        }
     }
-    /// Return argument node for chaining
-    return v;
 }
 
-// Compute one-time BP message helper
-bp_message& rec_gen_bp::compute_message_at(coupled_node *v, int b)
+// Override: report the message cache once all blocks of v are reconstructed
+void rec_gen_bp::finish_symbols(coupled_node *v)
 {
-    /// Check if the message already exists
-    bp_message*& orig_message = v->message(b, this->ped->all_genes->size(), std::pow(this->epsilon, v->num_ch()), this->memory_mode);
-    if (orig_message != NULL)
-        return *orig_message;
-    orig_message = new bp_message(0, this->ped->all_genes->size());
-    bp_message& message = *orig_message;
-    /// Iterate over all pairs of genes
-    for (gene g1 : v->all_des_genes[b])
-        for (gene g2 : v->all_des_genes[b])
-            if (g1 <= g2) {
-                /// Set up DP
-                long double num_missing_gene[v->num_ch() + 1][v->num_ch() + 1];
-                std::memset(num_missing_gene, 0, sizeof num_missing_gene);
-                num_missing_gene[0][0] = 1;
-                /// DP over children
-                int i = 1;
-                for (individual_node* indiv : *v) {
-                    coupled_node* ch = indiv->couple();
-                    bp_message& ch_msg = compute_message_at(ch, b);
-                    for (int j = 0; j < v->num_ch(); j++) {
-                        long double p = ch_msg.get_marginal(g1) + (g1 != g2) * (ch_msg.get_marginal(g2) - ch_msg[bp_domain(g1, g2)]);
-                        num_missing_gene[i][j] += num_missing_gene[i - 1][j] * p;
-                        num_missing_gene[i][j + 1] += num_missing_gene[i - 1][j] * (1 - p);
-                    }
-                    i++;
+    WPRINTF("Message cache after couple %lld: %lld hits, %lld misses, %lld evictions, %zu bytes held", v->get_id(),
+        (long long)this->cache->hits, (long long)this->cache->misses, (long long)this->cache->evictions, this->cache->bytes())
+}
+
+// Compute the missing messages of v at blocks [from, to), in the configured arithmetic
+void rec_gen_bp::compute_messages(coupled_node *v, int from, int to)
+{
+    switch (this->numeric) {
+        case BP_FLOAT: return compute_messages<bp_numeric<float, false>>(v, from, to);
+        case BP_LONG_DOUBLE: return compute_messages<bp_numeric<long double, false>>(v, from, to);
+        case BP_FLOAT | BP_LOG_SPACE: return compute_messages<bp_numeric<float, true>>(v, from, to);
+        case BP_DOUBLE | BP_LOG_SPACE: return compute_messages<bp_numeric<double, true>>(v, from, to);
+        case BP_LONG_DOUBLE | BP_LOG_SPACE: return compute_messages<bp_numeric<long double, true>>(v, from, to);
+        default: return compute_messages<bp_numeric<double, false>>(v, from, to);
+    }
+}
+
+// Pin the message of v at block b, recomputing it if it was evicted, in the configured arithmetic
+bp_message* rec_gen_bp::message_at(coupled_node *v, int b)
+{
+    switch (this->numeric) {
+        case BP_FLOAT: return message_at<bp_numeric<float, false>>(v, b);
+        case BP_LONG_DOUBLE: return message_at<bp_numeric<long double, false>>(v, b);
+        case BP_FLOAT | BP_LOG_SPACE: return message_at<bp_numeric<float, true>>(v, b);
+        case BP_DOUBLE | BP_LOG_SPACE: return message_at<bp_numeric<double, true>>(v, b);
+        case BP_LONG_DOUBLE | BP_LOG_SPACE: return message_at<bp_numeric<long double, true>>(v, b);
+        default: return message_at<bp_numeric<double, false>>(v, b);
+    }
+}
+
+// Pin the message of v at block b, recomputing it if it was evicted, in the arithmetic of policy N
+template <typename N>
+bp_message_of<typename N::real>* rec_gen_bp::message_at(coupled_node *v, int b)
+{
+    bp_message* msg;
+    while (!(msg = this->cache->acquire(v, b)))
+        compute_messages<N>(v, b, b + 1);
+    return static_cast<bp_message_of<typename N::real>*>(msg);
+}
+
+// Compute the missing messages of v at blocks [from, to), in the arithmetic of policy N
+/// The children are visited and sorted, and the scratch space of the DP is
+/// allocated, once for the whole tile
+template <typename N>
+void rec_gen_bp::compute_messages(coupled_node *v, int from, int to)
+{
+    typedef typename N::real T;
+    /// Find the blocks whose message does not exist yet
+    std::vector<int> blocks;
+    for (int b = from; b < to; b++)
+        if (!this->cache->contains(v, b))
+            blocks.push_back(b);
+    if (blocks.empty())
+        return;
+    /// At an extant couple, the messages hold only the couple's genes
+    if (v->num_ch() == 0) {
+        for (int b : blocks) {
+            bp_domain genes((*(*v)[0])[b], (*(*v)[1])[b]);
+            bp_message_of<T>* msg = new bp_message_of<T>(0, this->ped->all_genes->size(), genes[0] == genes[1] ?
+                std::vector<gene>{ genes[0] } : std::vector<gene>{ genes[0], genes[1] });
+            msg->inc(genes, 1);
+            this->cache->insert(v, b, msg);
+        }
+        return;
+    }
+    /// Visit children in ID order, so that the floating-point sums do not
+    /// depend on where nodes live in memory, once their tile is computed
+    /// (messages evicted meanwhile are recomputed block by block)
+    std::vector<coupled_node*> children;
+    for (individual_node* indiv : *v)
+        children.push_back(indiv->couple());
+    std::sort(children.begin(), children.end(), id_less());
+    for (coupled_node* ch : children)
+        compute_messages<N>(ch, from, to);
+    /// Weight of the children that miss a pair, by how many they are
+    int n = v->num_ch();
+    std::vector<T> eps_pow(n + 1);
+    for (int i = 0; i <= n; i++)
+        eps_pow[i] = N::power(this->epsilon, i);
+    /// Scratch space, reused across the blocks of the tile
+    std::vector<gene> genes;
+    std::vector<bp_message_of<T>*> ch_msgs(children.size());
+    std::vector<int> ch_index;
+    std::vector<T> ch_marginal, unnormalized;
+    std::vector<T> num_missing_gene(n + 1);
+    for (int b : blocks) {
+        /// Visit genes in increasing order
+        genes.assign(v->all_des_genes[b].begin(), v->all_des_genes[b].end());
+        std::sort(genes.begin(), genes.end());
+        bp_message_of<T>& message = *new bp_message_of<T>(0, this->ped->all_genes->size(), genes);
+        /// Remap the genes into the local domain of each child once, and
+        /// keep the marginals of the children by local index of this message
+        int k = genes.size();
+        ch_index.resize(children.size() * k);
+        ch_marginal.resize(children.size() * k);
+        for (int c = 0; c < children.size(); c++) {
+            ch_msgs[c] = message_at<N>(children[c], b);
+            for (int i = 0; i < k; i++) {
+                ch_index[c * k + i] = ch_msgs[c]->index_of(genes[i]);
+                ch_marginal[c * k + i] = ch_msgs[c]->get_marginal(genes[i]);
+            }
+        }
+        /// Iterate over all pairs of genes, keeping the unnormalized values
+        /// aside: in linear arithmetic they may underflow T on bushy couples
+        unnormalized.assign(k * (k + 1) / 2, N::zero());
+        T sum = N::zero();
+        for (int g1 = 0, at = 0; g1 < k; g1++)
+            for (int g2 = g1; g2 < k; g2++, at++) {
+                /// DP over children, on the number of them missing both genes
+                std::fill(num_missing_gene.begin(), num_missing_gene.end(), N::zero());
+                num_missing_gene[0] = N::one();
+                for (int c = 0; c < children.size(); c++) {
+                    int i1 = ch_index[c * k + g1], i2 = ch_index[c * k + g2];
+                    T pair = i1 < 0 || i2 < 0 ? ch_msgs[c]->get_nullval() : ch_msgs[c]->at(i1, i2);
+                    T p = ch_marginal[c * k + g1] + (g1 != g2) * (ch_marginal[c * k + g2] - pair);
+                    T has = N::from(p), misses = N::complement(p);
+                    for (int j = c + 1; j > 0; j--)
+                        num_missing_gene[j] = N::add(N::mul(num_missing_gene[j - 1], misses), N::mul(num_missing_gene[j], has));
+                    num_missing_gene[0] = N::mul(num_missing_gene[0], has);
                 }
                 /// Insert to distribution
-                bp_domain domain = bp_domain(g1, g2);
-                message.set(domain, 0);
-                for (int i = 0; i <= v->num_ch(); i++)
-                    message.inc(domain, num_missing_gene[v->num_ch()][i] * std::pow(this->epsilon, i));
-                WPRINTF("Marginal PDF (unnormalized) of genes %lld and %lld for couple %lld at block %d is %llf", g1, g2, v->get_id(), b, message[domain])
+                for (int i = 0; i <= n; i++)
+                    unnormalized[at] = N::add(unnormalized[at], N::mul(num_missing_gene[i], eps_pow[i]));
+                sum = N::add(sum, unnormalized[at]);
+                WPRINTF("Marginal PDF (unnormalized%s) of genes %lld and %lld for couple %lld at block %d is %Lf", N::log_space ? ", log" : "",
+                    genes[g1], genes[g2], v->get_id(), b, (long double)unnormalized[at])
             }
-    /// Normalize distribution
-    message.normalize();
-    return message;
+        /// Scale into the message
+        for (int g1 = 0, at = 0; g1 < k; g1++)
+            for (int g2 = g1; g2 < k; g2++)
+                message.inc_at(g1, g2, N::ratio(unnormalized[at++], sum));
+        /// Normalize distribution
+        message.normalize();
+        this->cache->insert(v, b, &message);
+        for (coupled_node* ch : children)
+            this->cache->release(ch, b);
+    }
 }
 
+// Destructor -- deletes the message cache
+rec_gen_bp::~rec_gen_bp() { delete this->cache; }
+
 long double rec_gen_bp::set_epsilon(long double epsilon) { return this->epsilon = epsilon; }
-int rec_gen_bp::set_memory_mode(int memory_mode) { return this->memory_mode = memory_mode; }
+size_t rec_gen_bp::set_mem_budget(size_t budget) { return this->cache->set_budget(budget); }
+int rec_gen_bp::set_numeric(int numeric) { return this->numeric = numeric; }
@@ -7,29 +7,92 @@
 #define REC_GEN_BP_H
 
 #include "rec_gen_quadratic.h"
+#include "bp_cache.h"
 
-#define MEM_PURGE_PAIRS (1 << 0)
-#define MEM_PURGE_CHILD (1 << 1)
+#include <algorithm>
+#include <limits>
+#include <cmath>
+
+// Blocks whose messages are computed together at a couple
+#define BP_TILE 64
+
+// Precisions BP may run in, and a flag to run its DP in log space
+#define BP_FLOAT 0
+#define BP_DOUBLE 1
+#define BP_LONG_DOUBLE 2
+#define BP_LOG_SPACE (1 << 2)
+
+// A bp_numeric policy is the arithmetic of the BP dynamic program: on
+// values of type T, either as they are or as their logarithms (which do
+// not underflow on couples with many children). The build assumes finite
+// math, so the logarithm of 0 is a finite floor that products saturate at
+template <typename T, bool LOG>
+struct bp_numeric
+{
+    typedef T real;
+    static const bool log_space = LOG;
+    /// Representations of 0 and 1
+    static T zero() { return LOG ? -std::numeric_limits<T>::max() / 4 : 0; }
+    static T one() { return LOG ? 0 : 1; }
+    /// Representations of a probability x, of 1 - x and of x^i
+    static T from(T x) { return !LOG ? x : x > 0 ? std::log(x) : zero(); }
+    static T complement(T x) { return !LOG ? 1 - x : x < 1 ? std::log1p(-x) : zero(); }
+    static T power(T x, int i) { return LOG ? i * from(x) : std::pow(x, i); }
+    /// Arithmetic on representations
+    static T mul(T a, T b) { return LOG ? std::max(a + b, zero()) : a * b; }
+    static T add(T a, T b)
+    {
+        if (!LOG)
+            return a + b;
+        if (a < b)
+            std::swap(a, b);
+        return b <= zero() ? a : a + std::log1p(std::exp(b - a));
+    }
+    /// The probability a / b
+    static T ratio(T a, T b) { return LOG ? std::exp(a - b) : a / b; }
+};
 
 // The rec_gen_bp class implements belief-propagation symbol collection
 class rec_gen_bp : public rec_gen_quadratic
 {
 protected:
-    // Override: reconstruct the genetic material of top-level coupled node v (returns v)
-    virtual coupled_node* collect_symbols(coupled_node* v);
-    /// Compute one-time BP message helper
-    bp_message& compute_message_at(coupled_node* v, int b);
+    // Override: initialize the descendant gene sets of v
+    virtual void prepare_symbols(coupled_node* v);
+    // Override: reconstruct blocks [from, to) of top-level coupled node v
+    virtual void collect_blocks(coupled_node* v, int from, int to);
+    // Override: report the message cache once v is reconstructed
+    virtual void finish_symbols(coupled_node* v);
+    /// Compute the missing messages of v at blocks [from, to), within one
+    /// tile, in the arithmetic of policy N
+    template <typename N>
+    void compute_messages(coupled_node* v, int from, int to);
+    /// Compute the missing messages of v at blocks [from, to), within one
+    /// tile, in the configured arithmetic
+    void compute_messages(coupled_node* v, int from, int to);
+    /// Pin the message of v at block b, recomputing it if it was evicted
+    /// (release it through the cache)
+    template <typename N>
+    bp_message_of<typename N::real>* message_at(coupled_node* v, int b);
+    bp_message* message_at(coupled_node* v, int b);
     /// Probability assigned to event of finding a child with a gene not in its parents
     long double epsilon = 0.01;
-    /// Types of strategies used to reduce memory footprint
-    int memory_mode = 0;
+    /// Messages of every couple, within a byte budget
+    bp_cache* cache = new bp_cache(0);
+    /// Precision of messages, and whether the DP runs in log space
+    int numeric = BP_DOUBLE;
+    /// Guards the first touch of the extant gene sets
+    std::mutex genes_lock;
 public:
     /// Inherit constructor
     using rec_gen_quadratic::rec_gen_quadratic;
+    /// Destructor -- deletes the message cache
+    ~rec_gen_bp();
     /// Epsilon mutator
     long double set_epsilon(long double epsilon);
-    /// Memory mode mutator
-    int set_memory_mode(int memory_mode);
+    /// Message memory budget mutator (in bytes, 0 for none)
+    size_t set_mem_budget(size_t budget);
+    /// Numeric mode mutator
+    int set_numeric(int numeric);
 };
 
 #endif
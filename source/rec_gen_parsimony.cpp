@@ -4,53 +4,102 @@
 ********************************************************************/
 
 #include "rec_gen_parsimony.h"
-#include "bp_message.h"
 
-// Override: reconstruct the genetic material of top-level coupled node v (returns v)
-coupled_node* rec_gen_parsimony::collect_symbols(coupled_node* v)
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// Override: initialize the min error sets of v and its children
+void rec_gen_parsimony::prepare_symbols(coupled_node* v)
 {
     /// Initialize the best-pairs map of v
     WPRINTF("Initializing min error sets for couple %lld", v->get_id())
-    v->min_err = new std::set<gene>[this->ped->num_blocks()]();
+    v->min_err = new std::vector<gene>[this->ped->num_blocks()]();
     /// If children have uninitialized min_err, initialize to just genes
-    for (individual_node* indiv : *v) {
-        coupled_node *ch = indiv->couple();
-        if (ch->min_err == NULL) {
-            WPRINTF("Initializing min error sets for couple %lld", ch->get_id())
-            ch->min_err = new std::set<gene>[this->ped->num_blocks()]();
-            for (int b = 0; b < this->ped->num_blocks(); b++)
-                ch->min_err[b].insert((*indiv)[b]);
-        }
-    }
+    /// Siblings of different parents may race here, so this goes through the couple's lock
+    for (individual_node* indiv : *v)
+        indiv->couple()->init_min_err();
+}
+
+// Override: reconstruct blocks [from, to) of top-level coupled node v
+/// The cost of a pair of genes is the number of children whose min error
+/// set holds neither; equivalently, the pair should cover the most
+/// children. Over a local domain of the genes of the children's sets,
+/// each gene gets a mask of the children holding it, so the cover of a
+/// pair is the popcount of the OR of its masks
+void rec_gen_parsimony::collect_blocks(coupled_node* v, int from, int to)
+{
+    int words = (v->num_ch() + PARSIMONY_WORD - 1) / PARSIMONY_WORD;
+    std::vector<gene> genes;
+    std::vector<uint64_t> masks;
+    std::vector<int> covers, order;
+    std::vector<std::pair<int, int>> min_pairs;
     /// Process each block
-    for (int b = 0; b < this->ped->num_blocks(); b++) {
-        /// Get a set of all genes worth considering
-        std::unordered_set<gene> des_genes;
+    for (int b = from; b < to; b++) {
+        /// Get the sorted local domain of all genes worth considering
+        genes.clear();
         for (individual_node* indiv : *v)
-            for (gene g : indiv->couple()->min_err[b])
-                des_genes.insert(g);
-        /// Iterate over all pairs, maintaining best current cost
-        int best_cost = v->num_ch();
-        std::set<bp_domain> min_pairs;
-        for (gene g1 : des_genes)
-            for (gene g2 : des_genes) {
-                int cost = 0;
-                for (individual_node* indiv : *v)
-                    cost += indiv->couple()->min_err[b].find(g1) == indiv->couple()->min_err[b].end() &&
-                        indiv->couple()->min_err[b].find(g2) == indiv->couple()->min_err[b].end();
-                if (cost < best_cost)
-                    best_cost = cost, min_pairs.clear();
-                if (cost == best_cost)
-                    min_pairs.insert(bp_domain(g1, g2));
-                WPRINTF("Cost of genes %lld and %lld for couple %lld at block %d is %d", g1, g2, v->get_id(), b, cost)
+            genes.insert(genes.end(), indiv->couple()->min_err[b].begin(), indiv->couple()->min_err[b].end());
+        std::sort(genes.begin(), genes.end());
+        genes.erase(std::unique(genes.begin(), genes.end()), genes.end());
+        int n = genes.size();
+        /// Mask the children holding each gene
+        masks.assign((size_t)n * words, 0);
+        int c = 0;
+        for (individual_node* indiv : *v) {
+            for (gene g : indiv->couple()->min_err[b]) {
+                size_t i = std::lower_bound(genes.begin(), genes.end(), g) - genes.begin();
+                masks[i * words + c / PARSIMONY_WORD] |= 1ull << c % PARSIMONY_WORD;
+            }
+            c++;
+        }
+        covers.assign(n, 0);
+        for (int i = 0; i < n; i++)
+            for (int w = 0; w < words; w++)
+                covers[i] += __builtin_popcountll(masks[(size_t)i * words + w]);
+        /// Visit genes by decreasing cover: a pair covers at most the sum of
+        /// the covers of its genes, so once that falls short of the best
+        /// cover, no later pair can reach it
+        order.resize(n);
+        for (int i = 0; i < n; i++)
+            order[i] = i;
+        std::sort(order.begin(), order.end(), [&](int i, int j) { return covers[i] > covers[j] || (covers[i] == covers[j] && i < j); });
+        /// Iterate over unordered pairs (a gene may pair with itself),
+        /// maintaining best current cover
+        int best_cover = -1;
+        long long scored = 0;
+        min_pairs.clear();
+        for (int x = 0; x < n && 2 * covers[order[x]] >= best_cover; x++)
+            for (int y = x; y < n; y++) {
+                int i = std::min(order[x], order[y]), j = std::max(order[x], order[y]);
+                int bound = x == y ? covers[i] : covers[i] + covers[j];
+                if (bound < best_cover) {
+                    if (x == y)
+                        continue;
+                    break;
+                }
+                int cover = 0;
+                for (int w = 0; w < words; w++)
+                    cover += __builtin_popcountll(masks[(size_t)i * words + w] | masks[(size_t)j * words + w]);
+                scored++;
+                if (cover > best_cover)
+                    best_cover = cover, min_pairs.clear();
+                if (cover == best_cover)
+                    min_pairs.push_back({ i, j });
             }
-        /// Select an arbitrary pair of genes from the best
-        v->insert_gene(b, (*min_pairs.begin())[0]);
-        v->insert_gene(b, (*min_pairs.begin())[1]);
-        DPRINTF("For couple %lld at position %d found genes %lld and %lld (cost: %d)", v->get_id(), b, (*(*v)[0])[b], (*(*v)[1])[b], best_cost)
+        WPRINTF("Scored %lld of %lld gene pairs for couple %lld at block %d", scored, (long long)n * (n + 1) / 2, v->get_id(), b)
+        /// Select the least pair of genes from the best
+        std::pair<int, int> pick = *std::min_element(min_pairs.begin(), min_pairs.end());
+        v->insert_gene(b, genes[pick.first]);
+        v->insert_gene(b, genes[pick.second]);
+        DPRINTF("For couple %lld at position %d found genes %lld and %lld (cost: %d)", v->get_id(), b, (gene)(*(*v)[0])[b], (gene)(*(*v)[1])[b], v->num_ch() - best_cover)
         /// Collect all genes into min_err
-        for (bp_domain d : min_pairs)
-            v->min_err[b].insert(d[0]), v->min_err[b].insert(d[1]);
+        std::vector<int> best_genes;
+        for (std::pair<int, int> p : min_pairs)
+            best_genes.push_back(p.first), best_genes.push_back(p.second);
+        std::sort(best_genes.begin(), best_genes.end());
+        best_genes.erase(std::unique(best_genes.begin(), best_genes.end()), best_genes.end());
+        for (int i : best_genes)
+            v->min_err[b].push_back(genes[i]);
     }
-    return v;
 }
@@ -8,12 +8,17 @@
 
 #include "rec_gen_quadratic.h"
 
+// Bits per word of the masks of children holding a gene
+#define PARSIMONY_WORD 64
+
 // The rec_gen_bp class implements belief-propagation symbol collection
 class rec_gen_parsimony : public rec_gen_quadratic
 {
 protected:
-    // Override: reconstruct the genetic material of top-level coupled node v (returns v)
-    virtual coupled_node* collect_symbols(coupled_node* v);
+    // Override: initialize the min error sets of v and its children
+    virtual void prepare_symbols(coupled_node* v);
+    // Override: reconstruct blocks [from, to) of top-level coupled node v
+    virtual void collect_blocks(coupled_node* v, int from, int to);
 public:
     /// Inherit constructor
     using rec_gen_quadratic::rec_gen_quadratic;
@@ -5,97 +5,259 @@
 ********************************************************************/
 
 #include "rec_gen_quadratic.h"
+#include "block_sampler.h"
+#include "gene_index.h"
+#include "pair_lsh.h"
 #include "logging.h"
-#include <cstring>
+#include <algorithm>
+#include <cmath>
 
-#define NUM_BIT 32
+// Blocks whose genes are gathered at once when collecting symbols
+#define COLLECT_BATCH 64
+// Couples per side of a tile of the candidate-pair search
+#define PAIR_TILE 64
+// Prefiltered pairs per task of the candidate-pair search
+#define LSH_PAIR_CHUNK 1024
+// Candidate pairs per task when completing triples
+#define TRIPLE_CHUNK 4
 
 /********************* QUADRATIC OVERRIDES *************************/
 
 // Reconstruct the genetic material of top-level coupled node v (returns v)
-/// IMPORTANT: All gene values must be no larger than extant population size!
-coupled_node* rec_gen_quadratic::collect_symbols(coupled_node* par)
+coupled_node* rec_gen_quadratic::collect_symbols(coupled_node* v)
+{
+    this->prepare_symbols(v);
+    this->collect_blocks(v, 0, this->ped->num_blocks());
+    this->finish_symbols(v);
+    return v;
+}
+
+// Symbol collection is thread-safe, pruned or not
+bool rec_gen_quadratic::parallel_symbols() { return true; }
+
+// Reconstruct blocks [from, to) of top-level coupled node v
+/// For each block, the two genes found among the descendants of the most
+/// children are inserted (ties go to the smaller gene); genes are only
+/// compared, so they may take any value
+void rec_gen_quadratic::collect_blocks(coupled_node* par, int from, int to)
 {
     // TODO: This step is making bad assumptions right now!
 
     /// Get a vector with all extant descendants by each direct child of par
-    std::vector<std::unordered_set<individual_node*>> extant(par->num_ch());
+    /// When pruning, each extant individual only counts for the first
+    /// child it descends from
+    std::vector<std::vector<individual_node*>> extant(par->num_ch());
+    desc_set seen;
     int i = 0; auto it = par->begin();
     for (; it != par->end(); i++, it++) {
-        extant[i] = (*it)->couple()->extant_desc(this->prune_dfs ? par : NULL);
+        extant[i] = (*it)->couple()->extant_desc(this->prune_dfs ? &seen : NULL);
+        if (this->prune_dfs)
+            seen.merge((*it)->couple()->extant_set());
         DPRINTF("Found %d extant descendants of couple %lld (child of %lld)", extant[i].size(), (*it)->couple()->get_id(), par->get_id())
     }
-    /// Populate for each block an array of which genes appear and with what frequency
-    unsigned desc_have_gene[par->num_ch()][(*this->ped)[0].size() / NUM_BIT + 2];
-    int num_block_appear[(*this->ped)[0].size() + 1];
-    for (int b = 0; b < this->ped->num_blocks(); b++) {
-        /// Reset the arrays
-        std::memset(desc_have_gene, 0, sizeof(desc_have_gene));
-        std::memset(num_block_appear, 0, sizeof(num_block_appear));
-        /// For each direct child, collect the genes that appear among its extant descendants
-        for (int ch = 0; ch < par->num_ch(); ch++) {
-            for (individual_node *ext : extant[ch])
-                desc_have_gene[ch][(*ext)[b] / NUM_BIT] |= 1 << (*ext)[b] % NUM_BIT;
-            for (int g = 1; g <= (*this->ped)[0].size(); g++)
-                num_block_appear[g] += (bool)(desc_have_gene[ch][g / NUM_BIT] & 1 << g % NUM_BIT);
+    /// Flatten the descendants, remembering the child each came through
+    std::vector<individual_node*> ext;
+    std::vector<int> owner;
+    for (int ch = 0; ch < par->num_ch(); ch++)
+        for (individual_node* e : extant[ch])
+            ext.push_back(e), owner.push_back(ch);
+    /// Genes of a batch of blocks, one row per descendant, and the
+    /// (gene, child) pairs of one block
+    std::vector<gene> batch(ext.size() * COLLECT_BATCH);
+    std::vector<std::pair<gene, int>> pairs;
+    pairs.reserve(ext.size());
+    for (int b0 = from; b0 < to; b0 += COLLECT_BATCH) {
+        int nb = std::min(COLLECT_BATCH, to - b0);
+        for (size_t e = 0; e < ext.size(); e++)
+            for (int k = 0; k < nb; k++)
+                batch[e * COLLECT_BATCH + k] = (*ext[e])[b0 + k];
+        for (int k = 0; k < nb; k++) {
+            int b = b0 + k;
+            /// Sort the known genes of the block by value, then by child
+            pairs.clear();
+            for (size_t e = 0; e < ext.size(); e++)
+                if (gene g = batch[e * COLLECT_BATCH + k])
+                    pairs.emplace_back(g, owner[e]);
+            std::sort(pairs.begin(), pairs.end());
+            /// Count the children each gene appears under, in increasing
+            /// order of gene, keeping the two most frequent
+            gene g1 = 0, g2 = 0;
+            int c1 = 0, c2 = 0;
+            for (size_t p = 0; p < pairs.size();) {
+                gene g = pairs[p].first;
+                int c = 0;
+                for (size_t q = p; p < pairs.size() && pairs[p].first == g; p++)
+                    c += p == q || pairs[p].second != pairs[p - 1].second;
+                if (c > c1)
+                    g2 = g1, g1 = g, c2 = c1, c1 = c;
+                else if (c > c2)
+                    g2 = g, c2 = c;
+            }
+            /// Double up genes if only one works
+            if (!g2)
+                g2 = g1, c2 = c1;
+            /// Add those genes
+            DPRINTF("For couple %lld at position %d found genes %lld and %lld (frequency: %d %d)", par->get_id(), b, g1, g2, c1, c2)
+            par->insert_gene(b, g1);
+            par->insert_gene(b, g2);
         }
-        /// Find the two most frequent genes in this block
-        int g1 = 0, g2 = 0, c1 = 0, c2 = 0;
-        for (int g = 1; g <= (*this->ped)[0].size(); g++)
-            if (num_block_appear[g] > c1)
-                g2 = g1, g1 = g, c2 = c1, c1 = num_block_appear[g];
-            else if (num_block_appear[g] > c2)
-                g2 = g, c2 = num_block_appear[g];
-        /// Double up genes if only one works
-        if (!g2)
-            g2 = g1, c2 = c1;
-        /// Add those genes
-        DPRINTF("For couple %lld at position %d found genes %lld and %lld (frequency: %d %d)", par->get_id(), b, g1, g2, c1, c2)
-        par->insert_gene(b, g1);
-        par->insert_gene(b, g2);
     }
-    /// Return the same couple
-    return par;
 }
 
 // Perform statistical tests to detect siblinghood (returns hypergraph)
 /// Currently considers all vertices, not just those with 99% rebuilt genomes
+/// Both phases are spread over the thread pool; matches are buffered per
+/// thread and merged in serial order, so the result does not depend on
+/// the number of threads
 rec_gen::hypergraph* rec_gen_quadratic::test_siblinghood()
 {
     /// Make a new graph
-    rec_gen_quadratic::hypergraph_basic* G = new hypergraph_basic();
-    /// Iterate over all pairs, inserting pairs that may form a triple into linked list
+    rec_gen_quadratic::hypergraph_basic* G = this->new_hypergraph();
+    /// Snapshot the grade in ID order so that couples can be addressed by index
+    std::vector<coupled_node*> grade(this->ped->begin(), this->ped->end());
+    std::sort(grade.begin(), grade.end(), id_less());
+    int n = grade.size();
+    /// A match records two indices and the number of shared blocks; matches sort in serial loop order
+    struct match
+    {
+        int a, b, shr;
+        bool operator<(const match& ot) const { return a == ot.a ? b < ot.b : a < ot.a; }
+    };
+    std::vector<std::vector<match>> found(this->pool->size());
+    auto merge_found = [&]() {
+        std::vector<match> all;
+        for (std::vector<match>& buf : found)
+            all.insert(all.end(), buf.begin(), buf.end()), buf.clear();
+        std::sort(all.begin(), all.end());
+        return all;
+    };
+    /// Iterate over all pairs tile by tile, buffering pairs that may form a triple
+    /// With the LSH prefilter, only check pairs that collide in some band
     WPRINT("Finding candidate pairs")
-    std::list<std::pair<coupled_node*, coupled_node*>> sib_cand;
-    for (auto it = ped->begin(); it != ped->end(); it++)
-        for (auto jt = std::next(it); jt != ped->end(); jt++) {
-            /// Count the number of shared blocks
-            int shared_blocks = 0;
-            for (int i = 0; i < this->ped->num_blocks(); i++)
-                shared_blocks += (*jt)->has_gene(i, (*(**it)[0])[i]) || (*jt)->has_gene(i, (*(**it)[1])[i]);
-            /// If the number of shared blocks is high enough, insert to candidates
-            if (shared_blocks >= this->cand * this->ped->num_blocks()) {
-                DPRINTF("Found candidate pair (%lld, %lld): %d/%d (%d%%) blocks shared", (*it)->get_id(), (*jt)->get_id(),
-                    shared_blocks, this->ped->num_blocks(), 100 * shared_blocks / this->ped->num_blocks())
-                sib_cand.emplace_back(*it, *jt);
-            }
-        }
+    /// With sequential tests, thresholds are decided from samples of blocks
+    block_sampler* sampler = this->seq_error > 0 ? new block_sampler(this->ped->num_blocks(), this->seq_error) : NULL;
+    double need_cand = this->cand * this->ped->num_blocks(), need_sib = this->sib * this->ped->num_blocks();
+    /// Counts stop as soon as they cannot reach the thresholds; counts that
+    /// reach them are only finished if the data log reports them
+    int stop_cand = std::ceil(need_cand), stop_sib = std::ceil(need_sib);
+    int stop = IS(LOG_DATA | VER_DATA) ? KERNEL_STOP_FAILED : KERNEL_STOP_SETTLED;
+    auto check = [&](int i, int j, int thread) {
+        /// If the number of shared blocks is high enough, insert to candidates
+        int shr = sampler ? sampler->shared_blocks(grade[i], grade[j], need_cand) : shared_blocks(grade[i], grade[j], stop_cand, stop);
+        if (shr >= need_cand)
+            found[thread].push_back({ i, j, shr });
+    };
+    if (this->lsh_bands > 0) {
+        std::vector<std::pair<int, int>> pairs = lsh_candidate_pairs(grade, this->ped->num_blocks(), this->lsh_bands, this->lsh_rows, this->pool);
+        WPRINTF("LSH prefilter kept %zu of %lld pairs", pairs.size(), (long long)n * (n - 1) / 2)
+        this->pool->run((pairs.size() + LSH_PAIR_CHUNK - 1) / LSH_PAIR_CHUNK, [&](int task, int thread) {
+            for (size_t p = (size_t)task * LSH_PAIR_CHUNK; p < std::min(pairs.size(), (size_t)(task + 1) * LSH_PAIR_CHUNK); p++)
+                check(pairs[p].first, pairs[p].second, thread);
+        });
+    }
+    else {
+        std::vector<std::pair<int, int>> tiles;
+        for (int ti = 0; ti < n; ti += PAIR_TILE)
+            for (int tj = ti; tj < n; tj += PAIR_TILE)
+                tiles.emplace_back(ti, tj);
+        this->pool->run(tiles.size(), [&](int task, int thread) {
+            for (int i = tiles[task].first; i < std::min(n, tiles[task].first + PAIR_TILE); i++)
+                for (int j = std::max(i + 1, tiles[task].second); j < std::min(n, tiles[task].second + PAIR_TILE); j++)
+                    check(i, j, thread);
+        });
+    }
+    std::vector<match> sib_cand = merge_found();
+    for (match& m : sib_cand)
+        DPRINTF("Found candidate pair (%lld, %lld): %d/%d (%d%%) blocks shared", grade[m.a]->get_id(), grade[m.b]->get_id(),
+            m.shr, this->ped->num_blocks(), 100 * m.shr / this->ped->num_blocks())
     WPRINTF("Found %lld candidate pairs (out of %lld); completing triples", sib_cand.size(), (long long)this->ped->size() * (this->ped->size() - 1) / 2)
-    /// For each pair, try to find a third element that completes the triple
-    for (std::pair<coupled_node*, coupled_node*> pcc : sib_cand)
-        for (coupled_node* coup : *this->ped)
-            /// Make sure elements are distinct and triple has not yet been processed
-            if (coup != pcc.first && coup != pcc.second && !G->query_edge({ pcc.first, pcc.second, coup })) {
-                /// Count the number of shared blocks
-                coupled_node *u = coup, *v = pcc.first, *w = pcc.second;
-                int shr = shared_blocks(u, v, w);
-                /// If the number of shared blocks is high enough, insert a hyperedge
-                if (shr >= this->sib * this->ped->num_blocks()) {
-                    DPRINTF("Inserting hypergraph edge (%lld, %lld, %lld): %d/%d (%d%%) blocks shared", u->get_id(), v->get_id(), w->get_id(),
-                         shr, this->ped->num_blocks(), 100 * shr / this->ped->num_blocks())
-                    G->insert_edge({ u, v, w });
+    /// For each pair, find the third elements that complete the triple
+    /// A third element shares with each member of the pair at least the
+    /// blocks it shares with both, so when the candidate threshold is no
+    /// higher than the sibling threshold, it is a candidate neighbour of
+    /// both: intersect their neighbour lists and check only those
+    /// Each triple is completed from one pair only: the first of its pairs
+    /// (as sorted grade indices) that is a candidate pair
+    int num_chunk = (sib_cand.size() + TRIPLE_CHUNK - 1) / TRIPLE_CHUNK;
+    std::vector<std::vector<int>> adj(n);
+    for (match& m : sib_cand)
+        adj[m.a].push_back(m.b), adj[m.b].push_back(m.a);
+    for (std::vector<int>& nb : adj)
+        std::sort(nb.begin(), nb.end());
+    if (this->cand <= this->sib) {
+        /// Every pair of such a triple is a candidate pair, so pair (a, b)
+        /// only takes third elements past b
+        this->pool->run(num_chunk, [&](int task, int thread) {
+            for (int c = task * TRIPLE_CHUNK; c < std::min((int)sib_cand.size(), (task + 1) * TRIPLE_CHUNK); c++) {
+                const std::vector<int> &na = adj[sib_cand[c].a], &nb = adj[sib_cand[c].b];
+                auto i = std::upper_bound(na.begin(), na.end(), sib_cand[c].b), j = std::upper_bound(nb.begin(), nb.end(), sib_cand[c].b);
+                for (; i != na.end() && j != nb.end(); )
+                    if (*i < *j)
+                        i++;
+                    else if (*j < *i)
+                        j++;
+                    else {
+                        /// If the number of shared blocks is high enough, keep the triple
+                        int k = *i++;
+                        j++;
+                        coupled_node *u = grade[k], *v = grade[sib_cand[c].a], *w = grade[sib_cand[c].b];
+                        int shr = sampler ? sampler->shared_blocks(u, v, w, need_sib) : shared_blocks(u, v, w, stop_sib, stop);
+                        if (shr >= need_sib)
+                            found[thread].push_back({ c, k, shr });
+                    }
+            }
+        });
+    }
+    /// Otherwise count, for every couple, the blocks at which it carries
+    /// a gene of the pair's shared signature (the non-zero genes both
+    /// members carry), through an inverted index of the grade; pair (a, b)
+    /// keeps a third element k only if no pair of the triple before (a, b)
+    /// is a candidate pair
+    else {
+        auto is_cand = [&](int x, int y) { return std::binary_search(adj[x].begin(), adj[x].end(), y); };
+        gene_index index(grade, this->ped->num_blocks());
+        WPRINTF("Indexed grade genes in %zu bytes", index.mem_usage())
+        this->pool->run(num_chunk, [&](int task, int thread) {
+            std::vector<int> count(n, 0), stamp(n, -1), touched;
+            for (int c = task * TRIPLE_CHUNK; c < std::min((int)sib_cand.size(), (task + 1) * TRIPLE_CHUNK); c++) {
+                coupled_node *u = grade[sib_cand[c].a], *v = grade[sib_cand[c].b];
+                for (int b = 0; b < this->ped->num_blocks(); b++) {
+                    gene g0 = (*(*u)[0])[b], g1 = (*(*u)[1])[b], h0 = (*(*v)[0])[b], h1 = (*(*v)[1])[b];
+                    auto hit = [&](uint32_t k) {
+                        if (stamp[k] == b)
+                            return;
+                        stamp[k] = b;
+                        if (!count[k]++)
+                            touched.push_back(k);
+                    };
+                    if (g0 && (g0 == h0 || g0 == h1))
+                        index.for_each(b, g0, hit);
+                    if (g1 && g1 != g0 && (g1 == h0 || g1 == h1))
+                        index.for_each(b, g1, hit);
                 }
+                /// Keep the couples that share enough blocks, then reset
+                std::sort(touched.begin(), touched.end());
+                int x = sib_cand[c].a, y = sib_cand[c].b;
+                for (int k : touched) {
+                    bool first = k > y || (k > x && k < y && !is_cand(x, k)) || (k < x && !is_cand(k, x) && !is_cand(k, y));
+                    if (first && count[k] >= this->sib * this->ped->num_blocks())
+                        found[thread].push_back({ c, k, count[k] });
+                    count[k] = 0, stamp[k] = -1;
+                }
+                touched.clear();
             }
+        });
+    }
+    if (sampler)
+        WPRINTF("%s", sampler->summary().c_str())
+    delete sampler;
+    /// Insert each triple as a hyperedge, in order of discovery
+    for (match& m : merge_found()) {
+        coupled_node *u = grade[m.b], *v = grade[sib_cand[m.a].a], *w = grade[sib_cand[m.a].b];
+        DPRINTF("Inserting hypergraph edge (%lld, %lld, %lld): %d/%d (%d%%) blocks shared", u->get_id(), v->get_id(), w->get_id(),
+             m.shr, this->ped->num_blocks(), 100 * m.shr / this->ped->num_blocks())
+        G->insert_edge({ u, v, w });
+    }
     WPRINTF("Completed siblinghood graph with %lld hyperedges", G->num_edge())
     /// Return the hypergraph
     return G;
@@ -103,4 +265,6 @@ rec_gen::hypergraph* rec_gen_quadratic::test_siblinghood()
 
 // Pruning mutator
 rec_gen_quadratic* rec_gen_quadratic::prune() { this->prune_dfs = true; return this; }
+// LSH prefilter mutator
+rec_gen_quadratic* rec_gen_quadratic::set_lsh(int bands, int rows) { this->lsh_bands = bands; this->lsh_rows = rows; return this; }
 
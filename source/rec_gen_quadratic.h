@@ -15,17 +15,26 @@ class rec_gen_quadratic : public rec_gen_basic
 {
 protected:
     // Override: reconstruct the genetic material of top-level coupled node v (returns v)
+    /// Prepares v and collects all of its blocks
     virtual coupled_node* collect_symbols(coupled_node* v);
+    // Override: reconstruct blocks [from, to) of top-level coupled node v
+    virtual void collect_blocks(coupled_node* v, int from, int to);
+    // Override: symbol collection is thread-safe, pruned or not
+    virtual bool parallel_symbols();
     // Override: perform statistical tests to detect siblinghood (returns hypergraph)
     virtual hypergraph* test_siblinghood();
-    // Whether to remove individuals from DFS consideration
-    bool prune_dfs;
+    // Whether to count each extant individual for only one child
+    bool prune_dfs = false;
+    // Bands and rows per band of the LSH prefilter (no prefilter if 0 bands)
+    int lsh_bands = 0, lsh_rows = 1;
 public:
     // Constructors
     /// Inherit
     using rec_gen_basic::rec_gen_basic;
     // Set DFS pruning
     rec_gen_quadratic* prune();
+    // Set the LSH prefilter of candidate pairs (0 bands to check all pairs)
+    rec_gen_quadratic* set_lsh(int bands, int rows);
 };
 
 #endif
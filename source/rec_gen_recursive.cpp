@@ -5,50 +5,82 @@
 
 #include "rec_gen_recursive.h"
 #include <algorithm>
+#include <vector>
 
 // The rec_gen_recursive class implements recursive genome-finding
-// Override: reconstruct the genetic material of top-level coupled node v (returns v)
-coupled_node* rec_gen_recursive::collect_symbols(coupled_node* v)
+// Override: reconstruct blocks [from, to) of top-level coupled node v
+/// The genes of the children at a block are gathered into one scratch
+/// buffer and sorted by gene, then by decreasing bushiness, so that the
+/// bushiness values of each gene form one sorted run
+void rec_gen_recursive::collect_blocks(coupled_node* v, int from, int to)
 {
-    /// Iterate through all blocks
-    for (int b = 0; b < this->ped->num_blocks(); b++) {
-        /// Map genes to the vectors of bushiness values that occur
-        std::unordered_map<gene, std::vector<int>> ch_block;
-        for (individual_node* ch : *v)
-            for (std::pair<gene, int> g : ch->couple()->get_des_genes(b)) {
-                ch_block[g.first].push_back(g.second);
-                DPRINTF("Found gene %lld at block %d of %lld for %lld, abundance %d", g.first, b, ch->couple()->get_id(), v->get_id(), g.second)
+    std::vector<std::pair<gene, int>> ch_block;
+    found_genes found;
+    /// Iterate through the blocks
+    for (int b = from; b < to; b++) {
+        /// Gather the genes of the children with their bushiness values
+        ch_block.clear();
+        for (individual_node* ch : *v) {
+            const des_gene_pool& des = ch->couple()->get_des_genes();
+            for (const std::pair<gene, int>* g = des.begin(b); g != des.end(b); g++) {
+                ch_block.push_back(*g);
+                DPRINTF("Found gene %lld at block %d of %lld for %lld, abundance %d", g->first, b, ch->couple()->get_id(), v->get_id(), g->second)
             }
+        }
         /// Sort children thresholds for each gene
-        for (auto it = ch_block.begin(); it != ch_block.end(); it++)
-            sort(it->second.begin(), it->second.end(), [&](int i, int j){ return i > j; });
+        std::sort(ch_block.begin(), ch_block.end(), [](const std::pair<gene, int>& x, const std::pair<gene, int>& y) {
+            return x.first < y.first || (x.first == y.first && x.second > y.second);
+        });
         /// Determine the recursively satisfied bushiness for each gene
         /// Insert those genes that are above bush_th
         /// Also keep track of the best and second-best genes to use as guesses
+        /// Ties go to the smaller gene, so that guesses do not depend on order
         gene b1 = 0, b2 = 0;
         int th1 = 0, th2 = 0;
-        for (auto it = ch_block.begin(); it != ch_block.end(); it++) {
+        for (size_t run = 0, end; run < ch_block.size(); run = end) {
             /// Get bushiness for this gene
+            gene g = ch_block[run].first;
             int th = 0;
-            for (int i = 0; i < it->second.size(); i++)
-                th = std::max(th, std::min(i + 1, it->second[i]));
-            DPRINTF("At block %d of %lld, gene %lld has abundance %d", b, v->get_id(), it->first, th)
+            for (end = run; end < ch_block.size() && ch_block[end].first == g; end++)
+                th = std::max(th, std::min((int)(end - run + 1), ch_block[end].second));
+            DPRINTF("At block %d of %lld, gene %lld has abundance %d", b, v->get_id(), g, th)
             /// Add if above threshold
             if (th >= this->bush_th)
-                v->insert_des_gene(b, it->first, th);
+                found.push_back({ b, { g, th } });
             /// Consider for guesses
-            if (th > th1) b2 = b1, th2 = th1, b1 = it->first, th1 = th;
-            else if (th > th2) b2 = it->first, th2 = th;
+            if (th > th1 || (th == th1 && g < b1)) b2 = b1, th2 = th1, b1 = g, th1 = th;
+            else if (th > th2 || (th == th2 && g < b2)) b2 = g, th2 = th;
         }
         /// Add guesses, inserting them also to the descendant genes list if necessary
         DPRINTF("For couple %lld at position %d found genes %lld and %lld (frequency: %d %d)", v->get_id(), b, b1, b2, th1, th2)
         v->insert_gene(b, b1)->insert_gene(b, b2);
         if (th1 < this->bush_th)
-            v->insert_des_gene(b, b1, th1);
+            found.push_back({ b, { b1, th1 } });
         if (th2 < this->bush_th)
-            v->insert_des_gene(b, b2, th2);
+            found.push_back({ b, { b2, th2 } });
+    }
+    this->commit_des_genes(v, from, to, found);
+}
+
+// Insert the descendant genes found in blocks [from, to) of v
+/// The last range of a couple to finish inserts those of all its ranges
+void rec_gen_recursive::commit_des_genes(coupled_node* v, int from, int to, found_genes& found)
+{
+    std::map<int, found_genes> ranges;
+    if (from == 0 && to == this->ped->num_blocks())
+        ranges[from].swap(found);
+    else {
+        std::lock_guard<std::mutex> guard(this->stage_lock);
+        staged_genes& st = this->staged[v];
+        st.ranges[from].swap(found);
+        if ((st.done += to - from) < this->ped->num_blocks())
+            return;
+        ranges.swap(st.ranges);
+        this->staged.erase(v);
     }
-    return v;
+    for (auto& range : ranges)
+        for (auto& f : range.second)
+            v->insert_des_gene(f.first, f.second.first, f.second.second);
 }
 /// Bushiness mutator
 int rec_gen_recursive::set_bush_th(int bush_th)
@@ -8,14 +8,33 @@
 
 #include "rec_gen_quadratic.h"
 
+#include <unordered_map>
+#include <utility>
+#include <mutex>
+#include <map>
+
 // The rec_gen_recursive class implements recursive genome-finding
 class rec_gen_recursive : public rec_gen_quadratic
 {
 protected:
-    // Override: reconstruct the genetic material of top-level coupled node v (returns v)
-    virtual coupled_node* collect_symbols(coupled_node* v);
+    // Override: reconstruct blocks [from, to) of top-level coupled node v
+    virtual void collect_blocks(coupled_node* v, int from, int to);
     /// Minimum bushiness threshold for recursive symbol collection
     int bush_th = 2;
+    // Descendant genes found in a block range: (block, (gene, bushiness))
+    typedef std::vector<std::pair<int, std::pair<gene, int>>> found_genes;
+    // Insert the descendant genes found in blocks [from, to) of v
+    /// Descendant genes must be inserted in block order, so the genes of
+    /// block ranges collected concurrently wait, keyed by their first block,
+    /// until every range of the couple is done
+    void commit_des_genes(coupled_node* v, int from, int to, found_genes& found);
+    struct staged_genes
+    {
+        std::map<int, found_genes> ranges;
+        int done = 0;
+    };
+    std::unordered_map<coupled_node*, staged_genes> staged;
+    std::mutex stage_lock;
 public:
     /// Inherit constructor
     using rec_gen_quadratic::rec_gen_quadratic;
@@ -0,0 +1,89 @@
+/********************************************************************
+* Implements a small thread pool that runs batches of independent
+* tasks across a fixed set of worker threads
+********************************************************************/
+
+#include "thread_pool.h"
+
+#include <algorithm>
+
+// Construct given the total number of threads (0 for all hardware threads)
+thread_pool::thread_pool(int num_threads)
+{
+    if (num_threads <= 0)
+        num_threads = std::max(1u, std::thread::hardware_concurrency());
+    this->job = NULL;
+    this->num_task = 0;
+    this->next_task = 0;
+    this->batch = 0;
+    this->busy = 0;
+    this->stop = false;
+    for (int i = 1; i < num_threads; i++)
+        this->workers.emplace_back(&thread_pool::work, this, i);
+}
+
+// Destructor -- wake and join the workers
+thread_pool::~thread_pool()
+{
+    {
+        std::lock_guard<std::mutex> lk(this->lock);
+        this->stop = true;
+    }
+    this->wake.notify_all();
+    for (std::thread& t : this->workers)
+        t.join();
+}
+
+// Number of threads, including the caller
+int thread_pool::size() { return this->workers.size() + 1; }
+
+// Claim and run tasks of the current batch until none remain
+void thread_pool::drain(int thread)
+{
+    for (int task; (task = this->next_task++) < this->num_task;)
+        (*this->job)(task, thread);
+}
+
+// Worker main loop: wait for a batch, help drain it, report back
+void thread_pool::work(int thread)
+{
+    long long seen = 0;
+    std::unique_lock<std::mutex> lk(this->lock);
+    while (true) {
+        this->wake.wait(lk, [&]() { return this->stop || this->batch != seen; });
+        if (this->stop)
+            return;
+        seen = this->batch;
+        lk.unlock();
+        this->drain(thread);
+        lk.lock();
+        if (--this->busy == 0)
+            this->done.notify_all();
+    }
+}
+
+// Run job(task, thread) for every task and wait until all are done
+void thread_pool::run(int num_task, const std::function<void(int task, int thread)>& job)
+{
+    /// Small batches and single-threaded pools run inline
+    if (this->workers.empty() || num_task <= 1) {
+        for (int task = 0; task < num_task; task++)
+            job(task, 0);
+        return;
+    }
+    /// Publish the batch and wake the workers
+    {
+        std::lock_guard<std::mutex> lk(this->lock);
+        this->job = &job;
+        this->num_task = num_task;
+        this->next_task = 0;
+        this->busy = this->workers.size();
+        this->batch++;
+    }
+    this->wake.notify_all();
+    /// Help out, then wait for the workers to finish
+    this->drain(0);
+    std::unique_lock<std::mutex> lk(this->lock);
+    this->done.wait(lk, [&]() { return this->busy == 0; });
+    this->job = NULL;
+}
@@ -0,0 +1,54 @@
+/********************************************************************
+* Defines a small thread pool that runs batches of independent tasks
+* across a fixed set of worker threads
+********************************************************************/
+
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <mutex>
+
+// The thread_pool class keeps num_threads - 1 workers alive; the thread
+// calling run() participates as thread 0. Tasks of a batch are claimed
+// one at a time from a shared counter, so uneven tasks balance out.
+class thread_pool
+{
+private:
+    // Worker threads
+    std::vector<std::thread> workers;
+    // Batch currently being executed
+    const std::function<void(int, int)>* job;
+    int num_task;
+    std::atomic<int> next_task;
+    // Synchronization
+    std::mutex lock;
+    std::condition_variable wake, done;
+    long long batch; /// Counts batches so workers notice new ones
+    int busy; /// Workers still executing the current batch
+    bool stop;
+    // Worker main loop
+    void work(int thread);
+    // Claim and run tasks of the current batch until none remain
+    void drain(int thread);
+public:
+    // No copying
+    thread_pool(const thread_pool& other);
+    thread_pool& operator=(const thread_pool&);
+    // Constructor
+    /// Given the total number of threads (0 for all hardware threads)
+    thread_pool(int num_threads);
+    // Destructor -- joins the workers
+    ~thread_pool();
+    // Number of threads, including the caller
+    int size();
+    // Run job(task, thread) for every task in [0, num_task) and wait
+    // until all are done; thread is in [0, size())
+    void run(int num_task, const std::function<void(int task, int thread)>& job);
+};
+
+#endif
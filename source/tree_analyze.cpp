@@ -3,19 +3,18 @@
 * Implements tools for analyzing the structure of poisson pedigrees:
 * - Descendants of unique children of non-joint-LCA
 * - Distribution of shared blocks in sibling and non-sibling triples
+* - Recall of the LSH prefilter of candidate pairs
 ********************************************************************/
 
 // TODO: Add inbreeding detection?
 
 #include "tree_analyze.h"
+#include "pair_lsh.h"
 
 #include <algorithm>
 
 // Printing macros
 #define UP_WIDTH(val, width) width = std::max(width, (int)std::to_string(val).length())
-#define PAD(val, width) (std::string(width - std::to_string(val).length(), ' ') + std::to_string(val))
-#define PAD_GENE(g) PAD(g, prep->gene_width)
-#define PAD_ID(id) PAD(id, prep->id_width)
 
 // Perform preprocessing on tree
 #define MERGE(x) merge(std::unordered_set<coupled_node*>(x))
@@ -170,16 +169,51 @@ std::vector<std::list<int>> sib_block_share_stat(preprocess* prep)
     return block_stat;
 }
 
+// Report for each generation how many of its candidate pairs the LSH
+// prefilter keeps
+/// Only grades 0 to num_grade - 2 are searched for siblings by Rec-Gen, so
+/// those are sampled; grade g is at index g
+std::vector<lsh_recall_stat> lsh_recall(preprocess* prep, int bands, int rows, double cand)
+{
+    std::vector<lsh_recall_stat> recall(std::max(0, prep->ped->num_grade() - 1), lsh_recall_stat{ 0, 0, 0, 0 });
+    thread_pool pool(0);
+    for (int g = 0; g < recall.size(); g++) {
+        lsh_recall_stat& r = recall[g];
+        std::vector<coupled_node*> grade((*prep->ped)[g].begin(), (*prep->ped)[g].end());
+        std::sort(grade.begin(), grade.end(), id_less());
+        int n = grade.size();
+        /// Mark the pairs that collide, then compare against all pairs
+        std::vector<std::pair<int, int>> pairs = lsh_candidate_pairs(grade, prep->ped->num_blocks(), bands, rows, &pool);
+        r.checked = pairs.size();
+        r.total = (long long)n * (n - 1) / 2;
+        auto p = pairs.begin();
+        for (int i = 0; i < n; i++)
+            for (int j = i + 1; j < n; j++) {
+                bool kept = p != pairs.end() && p->first == i && p->second == j;
+                p += kept;
+                if (shared_blocks(grade[i], grade[j]) >= cand * prep->ped->num_blocks())
+                    r.exact++, r.found += kept;
+            }
+    }
+    return recall;
+}
+
 // Display the induced pedigree of a given vertex, or the whole pedigree if
 // the argument vertex is NULL
 /// Prints out a depth-first traversal of the pedigree, replacing repeated
 /// vertices with the message `[backedge]`
 std::string print_sub_ped(preprocess* prep, coupled_node* v)
+{
+    std::string ans;
+    dump_writer out(ans);
+    print_sub_ped(prep, out, v);
+    out.flush();
+    return ans;
+}
+void print_sub_ped(preprocess* prep, dump_writer& out, coupled_node* v)
 {
     /// Recursion stack
     std::list<std::pair<coupled_node*, int>> stack;
-    /// Answer string
-    std::string ans;
     /// Visited couples
     std::unordered_set<coupled_node*> vis;
     /// Push v if it exists, otherwise the entire root population
@@ -191,25 +225,27 @@ std::string print_sub_ped(preprocess* prep, coupled_node* v)
     while (!stack.empty()) {
         /// Pop and print the entry
         auto front = stack.back(); stack.pop_back();
-        std::string id_record = std::string(front.second, '>') + " " + PAD_ID(front.first->get_id()) +
-            std::string(prep->ped->num_grade() - front.second, ' ');
-        ans += id_record;
+        out << std::string(front.second, '>') << ' ';
+        out.pad(front.first->get_id(), prep->id_width) << std::string(prep->ped->num_grade() - front.second, ' ');
         /// If already visited, don't recurse
         if (vis.find(front.first) != vis.end()) {
-            ans += "[backedge]\n";
+            out << "[backedge]\n";
             continue;
         }
         vis.insert(front.first);
         /// Print the genes
-        ans += "|";
-        for (int b = 0; b < prep->ped->num_blocks(); b++)
-            ans += PAD_GENE((*(*front.first)[0])[b]) + " " + PAD_GENE((*(*front.first)[1])[b]) + " | ";
-        ans[ans.length() - 1] = '\n';
+        out << '|';
+        for (int b = 0; b < prep->ped->num_blocks(); b++) {
+            if (b)
+                out << ' ';
+            out.pad((gene)(*(*front.first)[0])[b], prep->gene_width) << ' ';
+            out.pad((gene)(*(*front.first)[1])[b], prep->gene_width) << " |";
+        }
+        out << '\n';
         /// Push children
         for (individual_node* ch : *front.first)
             stack.emplace_back(ch->couple(), front.second + 1);
     }
-    return ans;
 }
 
 // Generate a tree-pedigree
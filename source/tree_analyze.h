@@ -3,6 +3,7 @@
 * Defines tools for analyzing the structure of poisson pedigrees:
 * - Descendants of unique children of non-joint-LCA
 * - Distribution of shared blocks in sibling and non-sibling triples
+* - Recall of the LSH prefilter of candidate pairs
 ********************************************************************/
 
 // TODO: Add inbreeding detection?
@@ -11,6 +12,7 @@
 #define TREE_ANALYZE_H
 
 #include "poisson_pedigree.h"
+#include "pedigree_text.h"
 
 // Structure that contains pedigree and preprocessing information
 struct preprocess
@@ -51,11 +53,27 @@ std::vector<std::list<int>*> block_share_stat(preprocess* prep, int start);
 /// sibling triples in each generation
 std::vector<std::list<int>> sib_block_share_stat(preprocess* prep);
 
+// Summary of the LSH prefilter on one generation
+struct lsh_recall_stat
+{
+    /// Candidate pairs found by the exact check and by the prefilter
+    long long exact, found;
+    /// Pairs that collided in some band, and all pairs
+    long long checked, total;
+};
+
+// Report for each generation how many of its candidate pairs (couples
+// sharing at least cand of their blocks) the LSH prefilter keeps
+/// Returns a vector indexed by grade, covering the grades Rec-Gen searches
+/// for siblings (all but the top one)
+std::vector<lsh_recall_stat> lsh_recall(preprocess* prep, int bands, int rows, double cand);
+
 // Display the induced pedigree of a given vertex, or the whole pedigree if
 // the argument vertex is NULL
 /// Prints out a depth-first traversal of the pedigree, replacing repeated
 /// vertices with the message `[backedge]`
 std::string print_sub_ped(preprocess* prep, coupled_node* v = NULL);
+void print_sub_ped(preprocess* prep, dump_writer& out, coupled_node* v = NULL);
 
 // Make tree-like pedigree
 poisson_pedigree* tree_ped(int B, int T, int A);
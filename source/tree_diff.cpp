@@ -8,6 +8,7 @@
 
 #include "tree_diff.h"
 
+#include <algorithm>
 #include <cstring>
 
 // Array resetting macro
@@ -40,15 +41,23 @@ tree_diff* tree_diff::blocks_check()
             auto bi = *it;
             if (bi.second && (*bi.first)[0] != (*bi.first)[1]) {
                 int old_attempted = this->blocks_attempted, old_correct = this->blocks_correct;
-                for (int b = 0; b < this->orig->num_blocks(); b++) {
+                /// Walk the runs of equal genes of the four genomes together
+                /// (single blocks, unless the genomes are segmented)
+                individual_node* g[4] = { (*bi.first)[0], (*bi.first)[1], (*bi.second)[0], (*bi.second)[1] };
+                for (int b = 0, end; b < this->orig->num_blocks(); b = end) {
+                    gene o0, o1, r0, r1;
+                    int e[4];
+                    o0 = g[0]->run(b, e[0]), o1 = g[1]->run(b, e[1]), r0 = g[2]->run(b, e[2]), r1 = g[3]->run(b, e[3]);
+                    end = std::min(std::min(e[0], e[1]), std::min(e[2], e[3]));
+                    int len = end - b;
                     /// Add the number of non-zero blocks to the count of attempted blocks
-                    ADD_TO_BUCKET(blocks_attempted, (bool)(*(*bi.second)[0])[b] + (bool)(*(*bi.second)[1])[b]);
+                    ADD_TO_BUCKET(blocks_attempted, len * ((bool)r0 + (bool)r1));
                     /// Add the number of correct blocks
-                    ADD_TO_BUCKET(blocks_correct, (*(*bi.first)[0])[b] == (*(*bi.second)[0])[b] || (*(*bi.first)[0])[b] == (*(*bi.second)[1])[b]);
+                    ADD_TO_BUCKET(blocks_correct, len * (o0 == r0 || o0 == r1));
                     /// If blocks are distinct, second block should match either
-                    ADD_TO_BUCKET(blocks_correct, (*(*bi.first)[1])[b] != (*(*bi.first)[0])[b] && ((*(*bi.first)[1])[b] == (*(*bi.second)[0])[b] || (*(*bi.first)[1])[b] == (*(*bi.second)[1])[b]));
+                    ADD_TO_BUCKET(blocks_correct, len * (o1 != o0 && (o1 == r0 || o1 == r1)));
                     /// Otherwise, it should match both
-                    ADD_TO_BUCKET(blocks_correct, (*(*bi.first)[1])[b] == (*(*bi.first)[0])[b] && (*(*bi.first)[1])[b] == (*(*bi.second)[0])[b] && (*(*bi.first)[1])[b] == (*(*bi.second)[1])[b]);
+                    ADD_TO_BUCKET(blocks_correct, len * (o1 == o0 && o1 == r0 && o1 == r1));
                 }
                 DPRINTF("Comparing blocks in grade %d pair (%lldo -> %lldr): %d (%d%%) attempted; %d (%d%%/%d%%) correct", this->orig->cur_grade(),
                     bi.first->get_id(), bi.second->get_id(),